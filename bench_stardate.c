@@ -0,0 +1,444 @@
+/*
+ *  bench_stardate: time the conversions in libstardate
+ *
+ *  Each benchmark runs one conversion over a fixed corpus of dates,
+ *  generated from a fixed seed so that every run times the same work,
+ *  and reports the mean time per conversion.  The parsers and formatters
+ *  are timed separately over each era of stardates, since they take
+ *  different paths through the code, and the formatters also over a run
+ *  of dates a fixed step apart, as the range mode writes them, each
+ *  alone and carried on from the last by a stepper; then whole streams
+ *  of dates are timed, both in process and through the stardate program
+ *  itself.
+ *
+ *  Usage: bench_stardate [-t] [rounds]
+ *  With -t, the results are written as tab-separated values.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stardate.h"
+
+#define NDATES 4096
+
+/* The input formats, each with a corpus of dates written in it */
+static struct fmt {
+  char opt;
+  char const *name;
+  unsigned (*in)(char const *, intdate *);
+  size_t (*out)(char *, intdate const *, unsigned);
+} fmts[] = {
+  { 's', "sd",      sd_sdin,      sd_sdout      },
+  { 'n', "newcalc", sd_newcalcin, sd_newcalcout },
+  { 'j', "jul",     sd_julin,     sd_julout     },
+  { 'g', "greg",    sd_gregin,    sd_gregout    },
+  { 'q', "qc",      sd_qcin,      sd_qcout      },
+  { 'u', "unixd",   sd_unixin,    sd_unixdout   },
+  { 'x', "unixx",   sd_unixin,    sd_unixxout   },
+};
+#define NFMTS (sizeof(fmts) / sizeof(*fmts))
+
+/* The eras of stardates, each converted by its own code: negative   *
+ * issues, the TOS and film eras, and the TNG era of 100000-unit      *
+ * issues.  The last, "all", spans them all.                          */
+static struct era {
+  char const *name, *lo, *hi;
+} eras[] = {
+  { "neg",  "1900-01-01", "2162-01-04" },
+  { "tos",  "2162-01-04", "2270-01-26" },
+  { "film", "2270-01-26", "2323-01-01" },
+  { "tng",  "2323-01-01", "2800-01-01" },
+  { "all",  "1900-01-01", "2800-01-01" },
+};
+#define NERAS (sizeof(eras) / sizeof(*eras))
+#define ALL (NERAS - 1)
+
+static char dates[NFMTS][NERAS][NDATES][SD_BUFSIZE];
+static size_t datebytes[NFMTS][NERAS]; /* 0 if the dates can't be read */
+static intdate dts[NERAS][NDATES];
+static char mixed[NDATES][SD_BUFSIZE]; /* all formats and eras at once */
+static size_t mixedbytes;
+static unsigned long rounds = 200;
+static int tsv;
+
+/* xorshift64: a small deterministic generator for the corpus */
+static uint64_t rngstate = UINT64_C(0x9e3779b97f4a7c15);
+
+static uint64_t rng(void)
+{
+  rngstate ^= rngstate << 13;
+  rngstate ^= rngstate >> 7;
+  rngstate ^= rngstate << 17;
+  return rngstate;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* result: report one benchmark; mbs is negative if not applicable */
+static void result(char const *name, double ns, double mbs)
+{
+  if(tsv)
+    printf(mbs < 0 ? "%s\t%.1f\t-\n" : "%s\t%.1f\t%.1f\n", name, ns, mbs);
+  else if(mbs < 0)
+    printf("%-20s %10.1f ns/op\n", name, ns);
+  else
+    printf("%-20s %10.1f ns/op %8.1f MB/s\n", name, ns, mbs);
+}
+
+/* randdate: a random date in an era, to a 2^-32 second */
+static void randdate(struct era const *e, intdate *dt)
+{
+  intdate lo, hi;
+  sd_gregin(e->lo, &lo);
+  sd_gregin(e->hi, &hi);
+  dt->sec = lo.sec + rng() % (hi.sec - lo.sec);
+  dt->frac = (uint32_t)rng();
+}
+
+/* The corpora.  The text corpora are written to two decimal places, and *
+ * each is only used if every date in it can be read back in: negative   *
+ * new calc stardates can't be, so there is only a TNG-era new calc      *
+ * input corpus.  The mixed corpus has each date, from any era, written  *
+ * in a randomly chosen format, so that parsing it exercises every input *
+ * format.                                                               */
+static void mkcorpus(void)
+{
+  unsigned f, e;
+  intdate dt;
+  int i;
+  for(e = 0; e < NERAS; e++)
+    for(i = 0; i < NDATES; i++)
+      randdate(&eras[e], &dts[e][i]);
+  for(f = 0; f < NFMTS; f++)
+    for(e = 0; e < NERAS; e++)
+      for(i = 0; i < NDATES; i++) {
+	randdate(&eras[e], &dt);
+	datebytes[f][e] += fmts[f].out(dates[f][e][i], &dt, 2) + 1;
+	if(sd_anyin(dates[f][e][i], &dt) != SD_OK) {
+	  datebytes[f][e] = 0;
+	  break;
+	}
+      }
+  for(i = 0; i < NDATES; ) {
+    struct fmt *x = &fmts[rng() % NFMTS];
+    randdate(&eras[ALL], &dt);
+    x->out(mixed[i], &dt, 2);
+    if(sd_anyin(mixed[i], &dt) == SD_OK)
+      mixedbytes += strlen(mixed[i++]) + 1;
+  }
+}
+
+/* seqin: the old way of finding a date's format, trying each parser *
+ * in turn until one of them recognises it.                          */
+static unsigned seqin(char const *date, intdate *dt)
+{
+  static unsigned (*const ins[])(char const *, intdate *) = {
+    sd_sdin, sd_newcalcin, sd_julin, sd_gregin, sd_qcin, sd_unixin
+  };
+  unsigned i, n = SD_NOMATCH;
+  for(i = 0; i < 6; i++)
+    if((n = ins[i](date, dt)) != SD_NOMATCH)
+      break;
+  return n;
+}
+
+static void benchin(char const *name, char const (*corpus)[SD_BUFSIZE],
+    size_t bytes, unsigned (*in)(char const *, intdate *))
+{
+  unsigned long r, bad = 0;
+  uint64_t sum = 0;
+  intdate dt;
+  double t;
+  int i;
+  t = now();
+  for(r = 0; r < rounds; r++)
+    for(i = 0; i < NDATES; i++) {
+      bad += in(corpus[i], &dt) != SD_OK;
+      sum += dt.sec;
+    }
+  t = now() - t;
+  if(bad || !sum)
+    fprintf(stderr, "bench_stardate: %s: conversion errors\n", name);
+  result(name, t * 1e9 / (rounds * NDATES), rounds * bytes / t / 1e6);
+}
+
+static void benchout(char const *name, intdate const *corpus, unsigned digits,
+    size_t (*out)(char *, intdate const *, unsigned))
+{
+  unsigned long r;
+  size_t bytes = 0;
+  char buf[NFMTS * SD_BUFSIZE];
+  double t;
+  int i;
+  t = now();
+  for(r = 0; r < rounds; r++)
+    for(i = 0; i < NDATES; i++)
+      bytes += out(buf, &corpus[i], digits);
+  t = now() - t;
+  result(name, t * 1e9 / (rounds * NDATES), bytes / t / 1e6);
+}
+
+/* The run of dates for the steppers: an hour and a quarter of a second *
+ * apart, from the start of 2263                                       */
+static intdate run[NDATES];
+
+static void mkrun(void)
+{
+  int i;
+  sd_gregin("2263-01-01", &run[0]);
+  for(i = 1; i < NDATES; i++) {
+    run[i].sec = run[i - 1].sec + 3600 + (run[i - 1].frac >= 0xc0000000U);
+    run[i].frac = run[i - 1].frac + 0x40000000U;
+  }
+}
+
+/* benchstep: time a stepper in format f over the run */
+static void benchstep(char const *name, struct fmt const *f, unsigned digits)
+{
+  struct sd_stepper st;
+  unsigned long r;
+  size_t bytes = 0;
+  char buf[SD_BUFSIZE];
+  double t;
+  int i;
+  sd_stepinit(&st, f->opt, digits);
+  t = now();
+  for(r = 0; r < rounds; r++)
+    for(i = 0; i < NDATES; i++)
+      bytes += sd_stepout(buf, &st, &run[i]);
+  t = now() - t;
+  result(name, t * 1e9 / (rounds * NDATES), bytes / t / 1e6);
+}
+
+/* Every output format on one line, as "stardate -s -n -j -g -q -u -x" *
+ * writes it: each format in turn, and all together by sd_multiout().  */
+static size_t alleach(char *ret, intdate const *dt, unsigned digits)
+{
+  char *pos = ret;
+  size_t f;
+  for(f = 0; f < NFMTS; f++) {
+    if(f)
+      *pos++ = ' ';
+    pos += fmts[f].out(pos, dt, digits);
+  }
+  return (size_t)(pos - ret);
+}
+
+static size_t alltogether(char *ret, intdate const *dt, unsigned digits)
+{
+  unsigned const alldigits[NFMTS] = { 2, 2, 2, 2, 2, 2, 2 };
+  (void)digits;
+  return sd_multiout(ret, dt, "snjgqux", alldigits);
+}
+
+/* Columns for the batch conversions */
+static int64_t unixsecs[NDATES];
+static uint64_t years[NDATES];
+static uint8_t months[NDATES], days[NDATES], hours[NDATES], mins[NDATES], secs[NDATES];
+static struct sd_calcols cols = { years, months, days, hours, mins, secs };
+static int64_t issues[NDATES];
+static uint32_t units[NDATES], fracs[NDATES];
+static struct sd_sdcols sdcols = { issues, units, fracs };
+static intdate batchdts[NDATES];
+
+static void unixtosdv(void)
+{
+  sd_unixinv(unixsecs, batchdts, NDATES);
+  sd_sdoutv(batchdts, &sdcols, NDATES);
+}
+
+static void greginv(void)
+{
+  if(sd_greginv(&cols, batchdts, NULL, NDATES) != NDATES)
+    batchdts[0].sec = 0;
+}
+
+static void gregoutv(void)
+{
+  sd_gregoutv(dts[ALL], &cols, NDATES);
+}
+
+static void juloutv(void)
+{
+  sd_juloutv(dts[ALL], &cols, NDATES);
+}
+
+/* benchv: time a batch conversion of the whole corpus at once */
+static void benchv(char const *name, void (*fn)(void))
+{
+  unsigned long r;
+  double t;
+  t = now();
+  for(r = 0; r < rounds; r++)
+    fn();
+  t = now() - t;
+  result(name, t * 1e9 / (rounds * NDATES), -1);
+}
+
+/* The streams: the mixed corpus, one date per line, converted to a *
+ * stardate and a Gregorian date per line as "stardate -s -g -f"     *
+ * would do it.                                                     */
+static char *stream;
+static size_t streamlen;
+
+static void mkstream(void)
+{
+  char *pos;
+  int i;
+  stream = pos = malloc(mixedbytes);
+  if(!stream) {
+    fprintf(stderr, "bench_stardate: out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  for(i = 0; i < NDATES; i++) {
+    size_t len = strlen(mixed[i]);
+    memcpy(pos, mixed[i], len);
+    pos[len] = '\n';
+    pos += len + 1;
+  }
+  streamlen = (size_t)(pos - stream);
+}
+
+/* benchstream: convert the stream in process, into an output buffer */
+static void benchstream(void)
+{
+  static char outbuf[65536];
+  unsigned long r, bad = 0;
+  size_t outlen = 0, outbytes = 0;
+  double t;
+  t = now();
+  for(r = 0; r < rounds; r++) {
+    char const *pos = stream, *end = stream + streamlen, *nl;
+    for(; pos != end; pos = nl + 1) {
+      intdate dt;
+      nl = memchr(pos, '\n', (size_t)(end - pos));
+      if(outlen > sizeof(outbuf) - 2 * SD_BUFSIZE) {
+	outbytes += outlen;
+	outlen = 0;
+      }
+      if(sd_anyinn(pos, (size_t)(nl - pos), &dt) != SD_OK) {
+	bad++;
+	outbuf[outlen++] = '\n';
+	continue;
+      }
+      outlen += sd_sdout(outbuf + outlen, &dt, 2);
+      outbuf[outlen++] = ' ';
+      outlen += sd_gregout(outbuf + outlen, &dt, 0);
+      outbuf[outlen++] = '\n';
+    }
+  }
+  t = now() - t;
+  if(bad || !(outbytes + outlen))
+    fprintf(stderr, "bench_stardate: stream: conversion errors\n");
+  result("stream", t * 1e9 / (rounds * NDATES), rounds * streamlen / t / 1e6);
+}
+
+/* benchprog: convert the stream, written rounds times over to a file, *
+ * with the stardate program, if it has been built alongside.          */
+static void benchprog(void)
+{
+  char path[] = "/tmp/bench_stardate.XXXXXX";
+  char cmd[sizeof(path) + 64];
+  unsigned long r;
+  FILE *fp;
+  double t;
+  int fd, st;
+  if(access("./stardate", X_OK))
+    return;
+  if((fd = mkstemp(path)) < 0 || !(fp = fdopen(fd, "w"))) {
+    perror("bench_stardate: temporary file");
+    return;
+  }
+  for(r = 0; r < rounds; r++)
+    fwrite(stream, 1, streamlen, fp);
+  fclose(fp);
+  sprintf(cmd, "./stardate -s -g -f %s >/dev/null", path);
+  t = now();
+  st = system(cmd);
+  t = now() - t;
+  unlink(path);
+  if(st)
+    fprintf(stderr, "bench_stardate: stardate -f: conversion errors\n");
+  result("stream stardate -f", t * 1e9 / (rounds * NDATES),
+      rounds * streamlen / t / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+  char name[40];
+  unsigned f, e;
+  int i;
+  if(argc > 1 && !strcmp(argv[1], "-t")) {
+    tsv = 1;
+    argv++;
+    argc--;
+  }
+  if(argc > 2) {
+    fprintf(stderr, "Usage: bench_stardate [-t] [rounds]\n");
+    return EXIT_FAILURE;
+  }
+  if(argc > 1) {
+    char *e;
+    errno = 0;
+    rounds = strtoul(argv[1], &e, 10);
+    if(*argv[1] < '0' || *argv[1] > '9' || *e || errno || !rounds) {
+      fprintf(stderr, "bench_stardate: bad number of rounds: %s\n"
+	  "Usage: bench_stardate [-t] [rounds]\n", argv[1]);
+      return EXIT_FAILURE;
+    }
+  }
+  if(tsv)
+    printf("benchmark\tns_per_op\tmb_per_s\n");
+  mkcorpus();
+  for(f = 0; f < NFMTS; f++)
+    for(e = 0; e < NERAS; e++)
+      if(datebytes[f][e]) {
+	sprintf(name, "in %s %s", fmts[f].name, eras[e].name);
+	benchin(name, dates[f][e], datebytes[f][e], fmts[f].in);
+      }
+  benchin("in mixed seqin", mixed, mixedbytes, seqin);
+  benchin("in mixed anyin", mixed, mixedbytes, sd_anyin);
+  for(f = 0; f < NFMTS; f++)
+    for(e = 0; e < NERAS; e++) {
+      sprintf(name, "out %s %s", fmts[f].name, eras[e].name);
+      benchout(name, dts[e], 2, fmts[f].out);
+    }
+  for(e = 0; e < NERAS; e++) {
+    sprintf(name, "out sd6 %s", eras[e].name);
+    benchout(name, dts[e], 6, sd_sdout);
+  }
+  benchout("out newcalc6 all", dts[ALL], 6, sd_newcalcout);
+  benchout("out all apart", dts[ALL], 2, alleach);
+  benchout("out all together", dts[ALL], 2, alltogether);
+  mkrun();
+  for(f = 0; f < NFMTS; f++) {
+    sprintf(name, "out %s run", fmts[f].name);
+    benchout(name, run, 2, fmts[f].out);
+    sprintf(name, "step %s run", fmts[f].name);
+    benchstep(name, &fmts[f], 2);
+  }
+  for(i = 0; i < NDATES; i++)
+    unixsecs[i] = (int64_t)(rng() % (UINT64_C(1) << 34)) - (INT64_C(1) << 33);
+  sd_gregoutv(dts[ALL], &cols, NDATES);
+  benchv("batch unix->sd", unixtosdv);
+  benchv("batch greg in", greginv);
+  benchv("batch greg out", gregoutv);
+  benchv("batch jul out", juloutv);
+  mkstream();
+  benchstream();
+  benchprog();
+  return 0;
+}
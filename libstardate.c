@@ -0,0 +1,1676 @@
+/*
+ *  libstardate: convert between date formats
+ *  by Andrew Main <zefram@fysh.org>
+ *  1997-12-26, stardate [-30]0458.96
+ *
+ *  Stardate code is based on version 1 of the Stardates in Star Trek FAQ.
+ */
+
+/*
+ * Copyright (c) 1996, 1997 Andrew Main.  All rights reserved.
+ *
+ * Redistribution and use, in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. All advertising materials mentioning features or use of this
+ *    software must display the following acknowledgement:
+ *        This product includes software developed by Andrew Main.
+ * 4. The name of Andrew Main may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL ANDREW MAIN BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ *  Unix programmers, please excuse the occasional DOSism in this code.
+ *  DOS programmers, please excuse the Unixisms.  All programmers, please
+ *  excuse the ANSIisms.  This program should actually run anywhere; I've
+ *  tried to make it strictly conforming C.
+ */
+
+/*
+ *  This library converts between dates in six formats:
+ *    - stardates (issue-based, from the Stardates FAQ)
+ *    - "new calc" TNG stardates (simple 1000 units/year from 2323)
+ *    - the Julian calendar (with UTC time)
+ *    - the Gregorian calendar (with UTC time)
+ *    - the Quadcent calendar (see the Stardates FAQ for explanation)
+ *    - traditional Unix time (seconds since 1970-01-01T00:00Z)
+ *  See stardate.h for the interface.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stardate.h"
+
+/* Digits are recognised without reference to the locale.  DIGIT(c) is *
+ * the value of the decimal digit c, or 10 or more if c isn't one.      */
+
+#define DIGIT(c) ((unsigned)((unsigned char)(c) - '0'))
+#define ISDIGIT(c) (DIGIT(c) < 10)
+
+char const *sd_strerror(unsigned n)
+{
+  switch(n) {
+    case SD_NOMATCH:  return "date format unrecognised";
+    case SD_OK:       return "success";
+    case SD_ERANGE:   return "date is out of acceptable range";
+    case SD_EINTEGER: return "integer part is out of range";
+    case SD_EMONTH:   return "month is out of range";
+    case SD_EDAY:     return "day is out of range";
+    case SD_EHOUR:    return "hour is out of range";
+    case SD_EMINUTE:  return "minute is out of range";
+    case SD_ESECOND:  return "second is out of range";
+    case SD_ETIME:    return "malformed time of day";
+    case SD_EUNIX:    return "malformed Unix date";
+    default:          return "unknown error";
+  }
+}
+
+/* Input formats can be told apart by their first few characters: a    *
+ * stardate starts with "[", a Unix date with "U", and the rest start   *
+ * with digits, the first character after which is the calendar        *
+ * separator, or "." or nothing for a new calc stardate.  This saves   *
+ * trying each parser in turn, which rescans the date from the start   *
+ * every time.                                                         */
+
+int sd_classify(char const *date)
+{
+  return sd_classifyn(date, strlen(date));
+}
+
+int sd_classifyn(char const *date, size_t len)
+{
+  char const *pos = date, *end = date + len;
+  if(pos == end)
+    return 0;
+  switch(*pos) {
+    case '[':
+      return 's';
+    case 'U': case 'u':
+      return 'u';
+  }
+  if(!ISDIGIT(*pos))
+    return 0;
+  while(++pos != end && ISDIGIT(*pos));
+  if(pos == end)
+    return 'n';
+  switch(*pos) {
+    case '-':
+      return 'g';
+    case '=':
+      return 'j';
+    case '*':
+      return 'q';
+    case '.':
+      return 'n';
+    default:
+      return 0;
+  }
+}
+
+static unsigned sdin(char const *, char const *, intdate *);
+static unsigned newcalcin(char const *, char const *, intdate *);
+static unsigned calin(char const *, char const *, intdate *, bool);
+static unsigned qcin(char const *, char const *, intdate *);
+static unsigned unixin(char const *, char const *, intdate *);
+
+unsigned sd_anyin(char const *date, intdate *dt)
+{
+  return sd_anyinn(date, strlen(date), dt);
+}
+
+unsigned sd_anyinn(char const *date, size_t len, intdate *dt)
+{
+  char const *end = date + len;
+  switch(sd_classifyn(date, len)) {
+    case 's': return sdin(date, end, dt);
+    case 'n': return newcalcin(date, end, dt);
+    case 'j': return calin(date, end, dt, 0);
+    case 'g': return calin(date, end, dt, 1);
+    case 'q': return qcin(date, end, dt);
+    case 'u': return unixin(date, end, dt);
+    default:  return SD_NOMATCH;
+  }
+}
+
+/* scandec: read the run of decimal digits at pos, stopping at end, into *
+ * *val, and return the position after it.  If the number doesn't fit   *
+ * in 64 bits, *val is set to UINT64_MAX and *ovf is set.  scanhex is    *
+ * the same for hexadecimal digits.                                      */
+static char const *scandec(char const *pos, char const *end, uint64_t *val, bool *ovf)
+{
+  uint64_t v = 0;
+  unsigned d;
+  for(; pos != end && (d = DIGIT(*pos)) < 10; pos++)
+    if(v < UINT64_MAX / 10 || (v == UINT64_MAX / 10 && d <= UINT64_MAX % 10))
+      v = v * 10 + d;
+    else {
+      v = UINT64_MAX;
+      *ovf = 1;
+    }
+  *val = v;
+  return pos;
+}
+
+static char const *scanhex(char const *pos, char const *end, uint64_t *val, bool *ovf)
+{
+  uint64_t v = 0;
+  unsigned d;
+  for(; pos != end; pos++) {
+    if((d = DIGIT(*pos)) >= 10) {
+      d = (unsigned)((unsigned char)*pos | 0x20) - 'a';
+      if(d >= 6)
+	break;
+      d += 10;
+    }
+    if(v <= UINT64_MAX >> 4)
+      v = v << 4 | d;
+    else {
+      v = UINT64_MAX;
+      *ovf = 1;
+    }
+  }
+  *val = v;
+  return pos;
+}
+
+/* digitat: whether there is a digit at pos */
+static bool digitat(char const *pos, char const *end)
+{
+  return pos != end && ISDIGIT(*pos);
+}
+
+/* Digit emitters for the output functions.  Each writes at pos and *
+ * returns the position after what it wrote; none of them writes a   *
+ * terminating NUL.  Decimal numbers are written two digits at a     *
+ * time from a table of all the two-digit pairs.                     */
+
+static char const digitpairs[201] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+  "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+/* put2: n (0-99) as exactly two digits */
+static char *put2(char *pos, unsigned n)
+{
+  memcpy(pos, digitpairs + 2 * n, 2);
+  return pos + 2;
+}
+
+/* putfixed: n as exactly `width` digits; n must be less than 10^width */
+static char *putfixed(char *pos, uint64_t n, unsigned width)
+{
+  char *end = pos + width;
+  pos = end;
+  while(width >= 2) {
+    pos -= 2;
+    memcpy(pos, digitpairs + 2 * (n % 100), 2);
+    n /= 100;
+    width -= 2;
+  }
+  if(width)
+    *--pos = (char)('0' + n);
+  return end;
+}
+
+/* putdec: n in decimal, with at least `min` digits */
+static char *putdec(char *pos, uint64_t n, unsigned min)
+{
+  unsigned width = 1;
+  uint64_t p = 10;
+  while(width < 20 && n >= p) {
+    width++;
+    p *= 10;
+  }
+  return putfixed(pos, n, width < min ? min : width);
+}
+
+/* puthex: n in hexadecimal, in lower case */
+static char *puthex(char *pos, uint64_t n)
+{
+  unsigned width = 1;
+  char *end;
+  while(width < 16 && n >> (4 * width))
+    width++;
+  end = pos += width;
+  do {
+    *--pos = "0123456789abcdef"[n & 15];
+    n >>= 4;
+  } while(--width);
+  return end;
+}
+
+/* putfrac: a decimal point followed by the first `digits` (1-6) digits *
+ * of the six-digit fraction frac6, truncating the rest.                 */
+static char *putfrac(char *pos, uint32_t frac6, unsigned digits)
+{
+  static uint32_t const scale[7] = { 1000000, 100000, 10000, 1000, 100, 10, 1 };
+  *pos++ = '.';
+  return putfixed(pos, frac6 / scale[digits], digits);
+}
+
+/* The length of one quadcent year, 12622780800 / 400 == 31556952 seconds. */
+#define QCYEAR 31556952UL
+#define STDYEAR 31536000UL
+
+/* Definitions to help with leap years. */
+static unsigned const nrmdays[12]={ 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+static unsigned const lyrdays[12]={ 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+#define jleapyear(y) ( !((y)%4L) )
+#define gleapyear(y) ( !((y)%4L) && ( ((y)%100L) || !((y)%400L) ) )
+#define jdays(y) (jleapyear(y) ? lyrdays : nrmdays)
+#define gdays(y) (gleapyear(y) ? lyrdays : nrmdays)
+#define xdays(gp, y) (((gp) ? gleapyear(y) : jleapyear(y)) ? lyrdays : nrmdays)
+
+/* The date 0323-01-01 (0323*01*01) is 117609 days after the internal   *
+ * epoch, 0001=01=01 (0000-12-30).  This is a difference of             *
+ * 117609*86400 (0x1cb69*0x15180) == 10161417600 (0x25daaed80) seconds. */
+static uint64_t const qcepoch = UINT64_C(0x25daaed80);
+
+/* The epoch for Unix time, 1970-01-01, is 719164 (0xaf93c) days after *
+ * our internal epoch, 0001=01=01 (0000-12-30).  This is a difference  *
+ * of 719164*86400 (0xaf93c*0x15180) == 62135769600 (0xe77949a00)      *
+ * seconds.                                                            */
+static uint64_t const unixepoch = UINT64_C(0xe77949a00);
+
+/* The arithmetic core.  Times are kept as unsigned seconds from the    *
+ * internal epoch, but the parsers work them out as signed 128-bit      *
+ * numbers of seconds, in two words of two's complement, so that no     *
+ * step on the way can overflow or wrap round, however far before the  *
+ * epoch or after it the date is; whether the time can be represented  *
+ * is checked just once, at the end, by wsec().  The formatters, going *
+ * the other way, find signed offsets from their own epochs by split(). */
+struct wide { uint64_t hi, lo; };
+
+static inline struct wide wfrom(uint64_t a)
+{
+  struct wide w;
+  w.hi = 0;
+  w.lo = a;
+  return w;
+}
+
+static inline struct wide wadd(struct wide a, struct wide b)
+{
+  a.lo += b.lo;
+  a.hi += b.hi + (a.lo < b.lo);
+  return a;
+}
+
+static inline struct wide wsub(struct wide a, struct wide b)
+{
+  a.hi -= b.hi + (a.lo < b.lo);
+  a.lo -= b.lo;
+  return a;
+}
+
+/* wmul: a*b, for b under 2^63, so that the product is positive */
+static inline struct wide wmul(uint64_t a, uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+  __extension__ unsigned __int128 p = (unsigned __int128)a * b;
+  struct wide w;
+  w.lo = (uint64_t)p;
+  w.hi = (uint64_t)(p >> 64);
+  return w;
+#else
+  uint64_t al = a & 0xffffffffU, ah = a >> 32;
+  uint64_t bl = b & 0xffffffffU, bh = b >> 32;
+  uint64_t lh = al * bh, hl = ah * bl, ll = al * bl;
+  uint64_t mid = (ll >> 32) + (lh & 0xffffffffU) + (hl & 0xffffffffU);
+  struct wide w;
+  w.lo = mid << 32 | (ll & 0xffffffffU);
+  w.hi = ah * bh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+  return w;
+#endif
+}
+
+/* wsec: the seconds of w, if it is in the range of an intdate */
+static inline bool wsec(struct wide w, uint64_t *sec)
+{
+  *sec = w.lo;
+  return !w.hi;
+}
+
+/* split: the quotient of (sec - epoch) / unit, rounded down, as its *
+ * magnitude with *neg set if it is negative, and the remainder, from *
+ * 0 to unit-1.                                                       */
+static inline uint64_t split(uint64_t sec, uint64_t epoch, uint64_t unit,
+    bool *neg, uint64_t *rem)
+{
+  uint64_t d;
+  if(sec >= epoch) {
+    *neg = 0;
+    *rem = (sec - epoch) % unit;
+    return (sec - epoch) / unit;
+  }
+  d = epoch - sec - 1;
+  *neg = 1;
+  *rem = unit - 1 - d % unit;
+  return d / unit + 1;
+}
+
+/* The epoch for stardates, 2162-01-04, is 789294 (0xc0b2e) days after *
+ * the internal epoch.  This is 789294*86400 (0xc0b2e*0x15180) ==      *
+ * 68195001600 (0xfe0bd2500) seconds.                                  */
+#define UFPEPOCH UINT64_C(0xfe0bd2500)
+
+/* The epoch for TNG-style stardates, 2323-01-01, is 848094 (0xcf0de) *
+ * days after the internal epoch.  This is 73275321600 (0x110f8cad00) *
+ * seconds.                                                           */
+#define TNGEPOCH UINT64_C(0x110f8cad00)
+
+/* Issue-based stardates run at a constant rate in each of a few eras, *
+ * so that they are piecewise linear in time.  This is the table of    *
+ * those pieces, in order.  Each starts at an anchor, a time and the   *
+ * stardate [issue]integer at that time, and runs to the anchor of the *
+ * next; the first runs back indefinitely into the negative issues as  *
+ * well, and the last on indefinitely.  The rate is num/den seconds    *
+ * per unit, or issuesecs per issue of issueunits units, or in the     *
+ * other direction mul/div millionths of a unit per second.            *
+ *                                                                     *
+ *           up to [19]7340      0.2 days/unit                         *
+ *        [19]7340 to [19]7840    10 days/unit                         *
+ *        [19]7840 to [20]5006     2 days/unit                         *
+ *             from [21]00000    146097/400 days per 1000 units        *
+ *                                                                     *
+ * [19]7340 is 197340 units of 17280 seconds after the stardate epoch, *
+ * and [19]7840 500 units of 864000 seconds after that.  [20]5006 is   *
+ * just where the TNG era begins, at its own epoch.                    */
+static struct sdseg {
+  uint64_t sec;
+  uint64_t issuesecs;
+  uint32_t issue, integer;
+  uint32_t issueunits;
+  uint32_t num, den;
+  uint32_t mul, div;
+} const sdsegs[] = {
+  { UFPEPOCH, 172800000, 0, 0, 10000, 17280, 1, 3125, 54 },
+  { UFPEPOCH + UINT64_C(197340) * 17280,
+      UINT64_C(8640000000), 19, 7340, 10000, 864000, 1, 125, 108 },
+  { UFPEPOCH + UINT64_C(197340) * 17280 + UINT64_C(500) * 864000,
+      1728000000, 19, 7840, 10000, 172800, 1, 625, 108 },
+  { TNGEPOCH, UINT64_C(3155695200), 21, 0, 100000,
+      27UL*146097UL, 125, 125000000UL, 27UL*146097UL },
+};
+#define NSDSEGS (sizeof(sdsegs) / sizeof(*sdsegs))
+#define TNGSEG (NSDSEGS - 1)
+
+static inline unsigned sdfrom(struct sdseg const *, bool, uint64_t, uint32_t,
+    uint32_t, intdate *);
+
+/* Conversion between day numbers and calendar dates, in constant time.  *
+ * Years are counted from 1 March, so that the leap day falls at the end *
+ * of the year.  The months from March then start (153*m+2)/5 days into  *
+ * the year, for m counting from 0, and the year itself can be found by  *
+ * division within the leap year cycle: 4 years of 1461 days for the     *
+ * Julian calendar, 400 years of 146097 days for the Gregorian.  This is *
+ * the method of Howard Hinnant's "chrono-Compatible Low-Level Date      *
+ * Algorithms".                                                          */
+
+/* The first shifted year starts on 0000=03=01, 306 days before the *
+ * internal epoch, or on 0000-03-01, 304 days before it.             */
+#define JMAR0 306U
+#define GMAR0 304U
+
+/* marchday: the day of the shifted year of month (1-12) and day (1-31) */
+static unsigned marchday(unsigned month, unsigned day)
+{
+  unsigned mp = month > 2 ? month - 3 : month + 9;
+  return (153*mp + 2) / 5 + day - 1;
+}
+
+/* frommarch: month (1-12) and day (1-31) of day doy of the shifted year */
+static void frommarch(unsigned doy, unsigned *month, unsigned *day)
+{
+  unsigned mp = (5*doy + 2) / 153;
+  *day = doy - (153*mp + 2) / 5 + 1;
+  *month = mp < 10 ? mp + 3 : mp - 9;
+}
+
+/* tocivil: the date `days` days after the internal epoch, and the day  *
+ * of its (January-based) year, counting from 0.                        */
+static uint64_t tocivil(uint64_t days, bool gregp, unsigned *month,
+    unsigned *day, unsigned *yday)
+{
+  uint64_t era, year;
+  unsigned doe, yoe, doy;
+  if(gregp) {
+    era = (days + GMAR0) / 146097U;
+    doe = (unsigned)(days + GMAR0 - era * 146097U);
+    yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+    doy = doe - (365*yoe + yoe/4 - yoe/100);
+    year = era * 400U + yoe;
+  } else {
+    era = (days + JMAR0) / 1461U;
+    doe = (unsigned)(days + JMAR0 - era * 1461U);
+    yoe = (doe - doe/1460) / 365;
+    doy = doe - 365*yoe;
+    year = era * 4U + yoe;
+  }
+  frommarch(doy, month, day);
+  if(*month > 2) {
+    *yday = doy + 59 + (gregp ? gleapyear(year) : jleapyear(year));
+    return year;
+  }
+  *yday = doy - 306;
+  return year + 1;
+}
+
+/* civil: the time of a date, and tod seconds into it, as a signed *
+ * number of seconds from the internal epoch                         */
+static struct wide civil(uint64_t year, unsigned month, unsigned day,
+    uint32_t tod, bool gregp)
+{
+  uint64_t cyc = gregp ? 400 : 4;
+  uint64_t cycsecs = (gregp ? 146097U : 1461U) * UINT64_C(86400);
+  unsigned yoe;
+  struct wide w;
+  if(month <= 2 && !year) {
+    /* January or February of year 0: the end of year -1, in cycle -1 */
+    yoe = (unsigned)cyc - 1;
+    w = wsub(wfrom(0), wfrom(cycsecs));
+  } else {
+    if(month <= 2)
+      year--;
+    yoe = (unsigned)(year % cyc);
+    w = wmul(year / cyc, cycsecs);
+  }
+  w = wadd(w, wfrom((uint64_t)(365*yoe + (gregp ? yoe/4 - yoe/100 : 0) +
+      marchday(month, day)) * 86400U + tod));
+  return wsub(w, wfrom((gregp ? GMAR0 : JMAR0) * UINT64_C(86400)));
+}
+
+struct caldate {
+  uint64_t year;
+  unsigned month, day;
+  unsigned hour, min, sec;
+  bool bigyear; /* year too large to represent */
+};
+static unsigned readcal(struct caldate *, char const *, char const *, char);
+
+unsigned sd_sdin(char const *date, intdate *dt)
+{
+  return sdin(date, date + strlen(date), dt);
+}
+
+static unsigned sdin(char const *pos, char const *end, intdate *dt)
+{
+  uint64_t nissue, ul;
+  uint32_t integer, frac = 0;
+  unsigned n;
+  bool negi, ovf = 0;
+  if(pos == end || *pos++ != '[')
+    return SD_NOMATCH;
+  negi = (pos != end && *pos == '-');
+  if(negi)
+    pos++;
+  if(!digitat(pos, end))
+    return SD_NOMATCH;
+  pos = scandec(pos, end, &nissue, &ovf);
+  if(pos == end || *pos++ != ']' || !digitat(pos, end))
+    return SD_NOMATCH;
+  pos = scandec(pos, end, &ul, &ovf);
+  if(ovf || ul > 99999UL ||
+      (!negi && nissue == 20 && ul > 5005UL) ||
+      ((negi || nissue < 20) && ul > 9999UL))
+    return SD_EINTEGER;
+  integer = (uint32_t)ul;
+  if(pos != end && *pos == '.') {
+    /* Six digits of fraction are used; any more are ignored. */
+    pos++;
+    for(n = 6; n--; ) {
+      frac *= 10;
+      if(digitat(pos, end))
+	frac += DIGIT(*pos++);
+    }
+    while(digitat(pos, end))
+      pos++;
+  }
+  if(pos != end)
+    return SD_NOMATCH;
+  /* Find the piece of the table the stardate is in, and convert it   *
+   * from that piece's anchor.  Negative issues are all in the first. */
+  if(negi)
+    return sdfrom(&sdsegs[0], 1, nissue, integer, frac, dt);
+  for(n = TNGSEG; n; n--)
+    if(nissue > sdsegs[n].issue ||
+	(nissue == sdsegs[n].issue && integer >= sdsegs[n].integer))
+      break;
+  switch(n) {
+    case 0:  return sdfrom(&sdsegs[0], 0, nissue, integer, frac, dt);
+    case 1:  return sdfrom(&sdsegs[1], 0, nissue - 19, integer, frac, dt);
+    case 2:  return sdfrom(&sdsegs[2], 0, nissue - 19, integer, frac, dt);
+    default: return sdfrom(&sdsegs[TNGSEG], 0, nissue - 21, integer, frac, dt);
+  }
+}
+
+/* sdfrom: the time of the stardate issues on from the anchor of piece s, *
+ * or back from it if neg, at integer+frac/1000000 units into the issue. *
+ * The seconds are exact and the fraction rounded up, so that the       *
+ * stardate output for the time is the one read.  Called with constant  *
+ * s, so that the divisions are by constants.                           */
+static inline unsigned sdfrom(struct sdseg const *s, bool neg,
+    uint64_t issues, uint32_t integer, uint32_t frac, intdate *dt)
+{
+  uint64_t d = (uint64_t)s->den * 1000000UL, t;
+  struct wide w, into;
+  if(integer < s->integer) {
+    integer += s->issueunits;
+    issues--;
+  }
+  t = ((uint64_t)(integer - s->integer) * 1000000UL + frac) * s->num;
+  w = wmul(issues, s->issuesecs);
+  into = wfrom(s->sec + t / d);
+  w = neg ? wsub(into, w) : wadd(w, into);
+  dt->frac = (uint32_t)((((t % d) << 32) + d - 1) / d);
+  return wsec(w, &dt->sec) ? SD_OK : SD_ERANGE;
+}
+
+/* New calc: simple TNG-style stardates.
+ * 1000 stardate units per Gregorian calendar year, epoch at 2323-01-01.
+ * Stardate = (year - 2323) * 1000 + (day_of_year / days_in_year) * 1000.
+ * Input format: a bare decimal number (no brackets), e.g. "41153.7".
+ */
+
+unsigned sd_newcalcin(char const *date, intdate *dt)
+{
+  return newcalcin(date, date + strlen(date), dt);
+}
+
+static unsigned newcalcin(char const *pos, char const *end, intdate *dt)
+{
+  uint64_t ipart, year, len, t = 0;
+  char const *digits;
+  bool ovf = 0, sticky = 0;
+
+  /* Must be digits, optionally a dot, then more digits */
+  if(!digitat(pos, end))
+    return SD_NOMATCH;
+  pos = scandec(pos, end, &ipart, &ovf);
+  if(ovf)
+    return SD_ERANGE;
+  digits = pos;
+  if(pos != end && *pos == '.')
+    for(digits = ++pos; digitat(pos, end); )
+      pos++;
+  if(pos != end)
+    return SD_NOMATCH; /* trailing junk -- not our format */
+
+  /* The stardate is (ipart % 1000).<digits> thousandths of the way   *
+   * through the year, which is 200*len ticks of 2^-32 seconds long;    *
+   * the ticks are then (ipart % 1000).<digits> * len / 5.  The         *
+   * fraction digits are taken from the last, so that t is always the   *
+   * fraction read so far times len, rounded down, with sticky          *
+   * recording whether anything was lost.  Rounding up at the end makes *
+   * the conversion back to a stardate give exactly the digits read.    */
+  year = 2323 + ipart / 1000;
+  len = (gleapyear(year) ? 366U : 365U) * (UINT64_C(432) << 32);
+  while(pos != digits) {
+    t += DIGIT(*--pos) * len;
+    sticky |= t % 10 != 0;
+    t /= 10;
+  }
+  t += ipart % 1000 * len;
+  sticky |= t % 5 != 0;
+  t = t / 5 + sticky;
+  dt->frac = (uint32_t)t;
+  return wsec(wadd(civil(year, 1, 1, 0, 1), wfrom(t >> 32)), &dt->sec) ?
+      SD_OK : SD_ERANGE;
+}
+
+unsigned sd_julin(char const *date, intdate *dt)
+{
+  return calin(date, date + strlen(date), dt, 0);
+}
+
+unsigned sd_gregin(char const *date, intdate *dt)
+{
+  return calin(date, date + strlen(date), dt, 1);
+}
+
+static unsigned calin(char const *pos, char const *end, intdate *dt, bool gregp)
+{
+  struct caldate c;
+  unsigned n = readcal(&c, pos, end, gregp ? '-' : '=');
+  if(n != SD_OK)
+    return n;
+  if(c.day > xdays(gregp, c.year)[c.month - 1])
+    return SD_EDAY;
+  dt->frac = 0;
+  if(!wsec(civil(c.year, c.month, c.day,
+      (uint32_t)(c.hour*3600UL + c.min*60UL + c.sec), gregp), &dt->sec))
+    return SD_ERANGE;
+  return c.bigyear ? SD_ERANGE : SD_OK;
+}
+
+unsigned sd_qcin(char const *date, intdate *dt)
+{
+  return qcin(date, date + strlen(date), dt);
+}
+
+static unsigned qcin(char const *pos, char const *end, intdate *dt)
+{
+  struct caldate c;
+  uint64_t t, f;
+  struct wide w;
+  unsigned n = readcal(&c, pos, end, '*');
+  if(n != SD_OK)
+    return n;
+  if(c.day > nrmdays[c.month - 1])
+    return SD_EDAY;
+  /* The quadcent year has no leap day, so its days from 1 January are *
+   * its days from 1 March, shifted round.                             */
+  n = (marchday(c.month, c.day) + 59) % 365;
+  t = (uint64_t)(n * 86400UL + c.hour * 3600UL + c.min * 60UL + c.sec);
+  t *= QCYEAR;
+  f = ((uint64_t)(t % STDYEAR) << 32) + STDYEAR - 1;
+  w = wadd(wmul(c.year, QCYEAR), wfrom(qcepoch + t / STDYEAR));
+  w = wsub(w, wfrom(323 * (uint64_t)QCYEAR));
+  dt->frac = (uint32_t)(f / STDYEAR);
+  if(!wsec(w, &dt->sec))
+    return SD_ERANGE;
+  return c.bigyear ? SD_ERANGE : SD_OK;
+}
+
+/* Most calendar dates come in one of two fixed layouts, yyyy-mm-dd and *
+ * yyyy-mm-ddThh:mm:ss (or with = or * for -), which are read eight     *
+ * bytes at a time instead of a character at a time.  Each word is      *
+ * loaded with its first character in the low byte, and checked for    *
+ * digits and separators all at once; then, with '0' taken off each    *
+ * digit, d*10 + (d>>8) has in each byte the two-digit number starting  *
+ * there.  This is plain 64-bit arithmetic, so it needs no particular   *
+ * instruction set.                                                     */
+
+#define BYTES(b) (UINT64_C(0x0101010101010101) * (b))
+
+/* load8: the eight characters at pos, the first in the low byte */
+static inline uint64_t load8(char const *pos)
+{
+  unsigned char const *p = (unsigned char const *)pos;
+  return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 |
+      (uint64_t)p[3] << 24 | (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 |
+      (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+}
+
+/* alldigits: whether the bytes of x selected by mask are all digits */
+static inline bool alldigits(uint64_t x, uint64_t mask)
+{
+  x &= mask;
+  mask &= BYTES(0xf0);
+  return (x & mask) == (BYTES('0') & mask) &&
+      ((x + BYTES(6)) & mask) == (BYTES('0') & mask);
+}
+
+/* pairs: the two-digit numbers in x, at the digits selected by mask */
+static inline uint64_t pairs(uint64_t x, uint64_t mask)
+{
+  uint64_t d = (x & mask) - (BYTES('0') & mask);
+  return d * 10 + (d >> 8);
+}
+
+/* Where the digits and separators are in the words of a fixed date */
+#define DATEDIGITS UINT64_C(0x00ffff00ffffffff)  /* yyyy-mm- */
+#define DATESEPS   UINT64_C(0xff0000ff00000000)
+#define DAYDIGITS  UINT64_C(0xffff000000000000)  /* yy-mm-dd */
+#define TIMEDIGITS UINT64_C(0xffff00ffff00ffff)  /* hh:mm:ss */
+#define TIMESEPS   UINT64_C(0x0000ff0000ff0000)
+
+/* readfixed: read a calendar date in one of the fixed layouts, if it *
+ * is in one, without checking the ranges of its fields               */
+static bool readfixed(struct caldate *c, char const *pos, char const *end,
+    char sep)
+{
+  size_t len = (size_t)(end - pos);
+  uint64_t x, y, z;
+  if(len != 10 && len != 19)
+    return 0;
+  x = load8(pos);
+  y = load8(pos + 2);
+  if((x & DATESEPS) != (BYTES((unsigned char)sep) & DATESEPS) ||
+      !alldigits(x, DATEDIGITS) || !alldigits(y, DAYDIGITS))
+    return 0;
+  if(len == 19) {
+    z = load8(pos + 11);
+    if((pos[10] | 0x20) != 't' ||
+	(z & TIMESEPS) != (BYTES(':') & TIMESEPS) || !alldigits(z, TIMEDIGITS))
+      return 0;
+    z = pairs(z, TIMEDIGITS);
+    c->hour = (unsigned)(z & 0xff);
+    c->min = (unsigned)(z >> 24 & 0xff);
+    c->sec = (unsigned)(z >> 48 & 0xff);
+  } else
+    c->hour = c->min = c->sec = 0;
+  x = pairs(x, DATEDIGITS);
+  c->year = (x & 0xff) * 100 + (x >> 16 & 0xff);
+  c->month = (unsigned)(x >> 40 & 0xff);
+  c->day = (unsigned)(pairs(y, DAYDIGITS) >> 48 & 0xff);
+  return 1;
+}
+
+/* readcal: read a calendar date, yyyy<sep>mm<sep>dd[Thh:mm[:ss]], in  *
+ * one pass.  A malformed date takes precedence over a field being out *
+ * of range, and the first field out of range is the one reported.     */
+static unsigned readcal(struct caldate *c, char const *pos, char const *end, char sep)
+{
+  uint64_t v;
+  bool ovf = 0;
+  unsigned err = SD_OK;
+  c->bigyear = 0;
+  if(readfixed(c, pos, end, sep)) {
+    /* Well formed, so only the ranges are left to check */
+    if(!c->month || c->month > 12)
+      return SD_EMONTH;
+    if(!c->day || c->day > 31)
+      return SD_EDAY;
+    if(c->hour > 23)
+      return SD_EHOUR;
+    if(c->min > 59)
+      return SD_EMINUTE;
+    return c->sec > 59 ? SD_ESECOND : SD_OK;
+  }
+  if(!digitat(pos, end))
+    return SD_NOMATCH;
+  pos = scandec(pos, end, &c->year, &c->bigyear);
+  if(pos == end || *pos++ != sep || !digitat(pos, end))
+    return SD_NOMATCH;
+  pos = scandec(pos, end, &v, &ovf);
+  if(ovf || !v || v > 12UL)
+    err = SD_EMONTH;
+  c->month = (unsigned)v;
+  if(pos == end || *pos++ != sep || !digitat(pos, end))
+    return SD_NOMATCH;
+  pos = scandec(pos, end, &v, &ovf);
+  if(err == SD_OK && (ovf || !v || v > 31UL))
+    err = SD_EDAY;
+  c->day = (unsigned)v;
+  c->hour = c->min = c->sec = 0;
+  if(pos == end)
+    return err;
+  if((*pos != 'T' && *pos != 't') || !digitat(++pos, end))
+    return SD_ETIME;
+  pos = scandec(pos, end, &v, &ovf);
+  if(err == SD_OK && (ovf || v > 23UL))
+    err = SD_EHOUR;
+  c->hour = (unsigned)v;
+  if(pos == end || *pos++ != ':' || !digitat(pos, end))
+    return SD_ETIME;
+  pos = scandec(pos, end, &v, &ovf);
+  if(err == SD_OK && (ovf || v > 59UL))
+    err = SD_EMINUTE;
+  c->min = (unsigned)v;
+  if(pos == end)
+    return err;
+  if(*pos++ != ':' || !digitat(pos, end))
+    return SD_ETIME;
+  pos = scandec(pos, end, &v, &ovf);
+  if(err == SD_OK && (ovf || v > 59UL))
+    err = SD_ESECOND;
+  c->sec = (unsigned)v;
+  if(pos != end)
+    return SD_ETIME;
+  return err;
+}
+
+unsigned sd_unixin(char const *date, intdate *dt)
+{
+  return unixin(date, date + strlen(date), dt);
+}
+
+static unsigned unixin(char const *pos, char const *end, intdate *dt)
+{
+  bool neg, ovf = 0;
+  char const *digits;
+  uint64_t mag;
+  struct wide w = wfrom(unixepoch);
+  if(pos == end || (*pos != 'u' && *pos != 'U'))
+    return SD_NOMATCH;
+  pos++;
+  neg = (pos != end && *pos == '-');
+  if(neg)
+    pos++;
+  digits = pos;
+  if(end - pos > 2 && pos[0] == '0' && (pos[1] == 'x' || pos[1] == 'X'))
+    pos = scanhex(digits += 2, end, &mag, &ovf);
+  else
+    pos = scandec(pos, end, &mag, &ovf);
+  if(pos == digits || pos != end)
+    return SD_EUNIX;
+  w = neg ? wsub(w, wfrom(mag)) : wadd(w, wfrom(mag));
+  dt->frac = 0;
+  return ovf || !wsec(w, &dt->sec) ? SD_ERANGE : SD_OK;
+}
+
+/* The parts of an issue-based stardate, as written by sd_sdout() and *
+ * sd_sdoutv().                                                        */
+struct sdparts {
+  bool isneg, tng;
+  uint64_t nissue;
+  uint32_t integer;
+  uint32_t frac6; /* millionths of a unit, rounded down */
+};
+
+static void sdsplit(struct sdparts *, intdate const *);
+static inline void sdto(struct sdparts *, intdate const *, struct sdseg const *);
+static inline void sdunits(struct sdparts *, struct sdseg const *, bool,
+    uint64_t, uint64_t);
+static char *putsd(char *, struct sdparts const *, unsigned);
+
+size_t sd_sdout(char *ret, intdate const *dt, unsigned digits)
+{
+  struct sdparts p;
+  char *pos;
+  sdsplit(&p, dt);
+  pos = putsd(ret, &p, digits);
+  *pos = 0;
+  return (size_t)(pos - ret);
+}
+
+/* putsd: the stardate p, to `digits` places */
+static char *putsd(char *pos, struct sdparts const *p, unsigned digits)
+{
+  *pos++ = '[';
+  if(p->isneg)
+    *pos++ = '-';
+  pos = putdec(pos, p->nissue, 1);
+  *pos++ = ']';
+  pos = putdec(pos, p->integer, p->tng ? 5 : 4);
+  if(digits)
+    pos = putfrac(pos, p->frac6, digits > 6 ? 6 : digits);
+  return pos;
+}
+
+static void sdsplit(struct sdparts *p, intdate const *dt)
+{
+  unsigned n;
+  for(n = TNGSEG; n; n--)
+    if(dt->sec >= sdsegs[n].sec)
+      break;
+  switch(n) {
+    case 0:  sdto(p, dt, &sdsegs[0]); break;
+    case 1:  sdto(p, dt, &sdsegs[1]); break;
+    case 2:  sdto(p, dt, &sdsegs[2]); break;
+    default: sdto(p, dt, &sdsegs[TNGSEG]); break;
+  }
+}
+
+/* sdto: the stardate of a time in piece s of the table, or before the *
+ * first.  The fraction is rounded down, to a millionth of a unit.     *
+ * Like sdfrom(), called with constant s.                              */
+static inline void sdto(struct sdparts *p, intdate const *dt,
+    struct sdseg const *s)
+{
+  uint64_t rem, h;
+  /* Before the stardate epoch, negative issues count back from it */
+  uint64_t issues = split(dt->sec, s->sec, s->issuesecs, &p->isneg, &rem);
+  /* The time into the issue, scaled to millionths of a unit and *
+   * rounded down.  It is under 2^33 seconds, and mul under 2^27, *
+   * so this can't overflow.                                      */
+  h = rem * s->mul + ((uint64_t)dt->frac * s->mul >> 32);
+  sdunits(p, s, p->isneg, issues, h / s->div);
+}
+
+/* sdunits: the stardate h millionths of a unit into the issue `issues` *
+ * issues from the anchor of piece s (back from it, if neg)              */
+static inline void sdunits(struct sdparts *p, struct sdseg const *s, bool neg,
+    uint64_t issues, uint64_t h)
+{
+  p->isneg = neg;
+  p->tng = s->issueunits == 100000;
+  p->frac6 = (uint32_t)(h % 1000000UL);
+  p->integer = s->integer + (uint32_t)(h / 1000000UL);
+  if(neg)
+    p->nissue = issues;
+  else {
+    p->nissue = s->issue + issues;
+    if(p->integer >= s->issueunits) {
+      p->integer -= s->issueunits;
+      p->nissue++;
+    }
+  }
+}
+
+/* New calc output: simple TNG-style stardate.
+ * Converts intdate to Gregorian, then computes:
+ *   stardate = (year - 2323) * 1000 + (day_of_year / days_in_year) * 1000
+ * The units and the fraction digits are found together, by one division
+ * of the time into the year by the length of the year, and the last
+ * digit is rounded to nearest, ties to even.  With no digits, the
+ * stardate is truncated towards zero.
+ */
+static uint32_t const powers10[10] = { 1, 10, 100, 1000, 10000, 100000,
+  1000000, 10000000, 100000000, 1000000000 };
+
+static char *putnewcalc(char *, intdate const *, uint64_t, unsigned, unsigned);
+static char *newcalcq(char *, uint64_t, uint64_t, uint64_t, unsigned);
+static inline uint64_t divpow10(uint64_t, unsigned, uint64_t *);
+
+size_t sd_newcalcout(char *ret, intdate const *dt, unsigned digits)
+{
+  unsigned month, day, yday;
+  uint64_t year = tocivil(dt->sec / 86400UL, 1, &month, &day, &yday);
+  char *pos = putnewcalc(ret, dt, year, yday, digits);
+  *pos = 0;
+  return (size_t)(pos - ret);
+}
+
+/* putnewcalc: the new calc stardate of dt, which is on day yday of the *
+ * Gregorian year `year`, to `digits` places.                           *
+ *                                                                      *
+ * The time into the year is s seconds and f 2^-32 seconds, and the     *
+ * year is len seconds long, so the units and digits together are       *
+ * q = (s*2^32 + f) * 10^n / (len*2^32), for n = 3+digits.  With        *
+ * f*10^n == fh*2^32 + fl, that is (s*10^n + fh + fl/2^32) / len, and   *
+ * as fl/2^32 is under 1, q is just (s*10^n + fh) / len, which fits in  *
+ * 64 bits; the remainder, in 2^-32 seconds, has fl back on the end.    */
+static char *putnewcalc(char *pos, intdate const *dt, uint64_t year,
+    unsigned yday, unsigned digits)
+{
+  bool leap = gleapyear(year);
+  uint64_t len = (leap ? 366U : 365U) * UINT64_C(86400);
+  uint64_t sec = yday * 86400UL + dt->sec % 86400UL, f, num, q;
+  if(digits > 6)
+    digits = 6;
+  f = (uint64_t)dt->frac * powers10[3 + digits];
+  num = sec * powers10[3 + digits] + (f >> 32);
+  /* Dividing by each constant lets the compiler multiply instead */
+  q = leap ? num / (366U * UINT64_C(86400)) : num / (365U * UINT64_C(86400));
+  return newcalcq(pos, year, q, (num - q * len) << 32 | (f & 0xffffffffU),
+      digits);
+}
+
+/* newcalcq: the new calc stardate q units and digits (q/10^digits units) *
+ * into the Gregorian year `year`, with rem 2^-32 seconds left over, to  *
+ * `digits` (0-6) places                                                 */
+static char *newcalcq(char *pos, uint64_t year, uint64_t q, uint64_t rem,
+    unsigned digits)
+{
+  uint64_t len = (gleapyear(year) ? 366U : 365U) * (UINT64_C(86400) << 32);
+  uint64_t ipart, fpart, scale = powers10[digits];
+  bool neg = year < 2323;
+  if(!neg) {
+    ipart = (year - 2323) * 1000 + divpow10(q, digits, &fpart);
+  } else {
+    /* Counting back from 2323, the fraction of a unit left over is *
+     * the complement of the one into the year                       */
+    uint64_t mag = (2323 - year) * 1000 * scale - q;
+    if(rem) {
+      mag--;
+      rem = len - rem;
+    }
+    ipart = divpow10(mag, digits, &fpart);
+  }
+  if(!digits) {
+    if(neg && ipart)
+      *pos++ = '-';
+    return putdec(pos, ipart, 1);
+  }
+  if(2 * rem > len || (2 * rem == len && (fpart & 1))) {
+    if(++fpart == scale) {
+      fpart = 0;
+      ipart++;
+    }
+  }
+  if(neg)
+    *pos++ = '-';
+  pos = putdec(pos, ipart, 1);
+  *pos++ = '.';
+  return putfixed(pos, fpart, digits);
+}
+
+/* divpow10: n / 10^digits, and the remainder, for digits from 0 to 6, *
+ * each by a constant                                                  */
+static inline uint64_t divpow10(uint64_t n, unsigned digits, uint64_t *rem)
+{
+  uint64_t q;
+  switch(digits) {
+    case 0:  *rem = 0; return n;
+    case 1:  q = n / 10U; break;
+    case 2:  q = n / 100U; break;
+    case 3:  q = n / 1000U; break;
+    case 4:  q = n / 10000U; break;
+    case 5:  q = n / 100000U; break;
+    default: q = n / 1000000U; break;
+  }
+  *rem = n - q * powers10[digits];
+  return q;
+}
+
+static size_t calout(char *, intdate const *, bool);
+
+size_t sd_julout(char *ret, intdate const *dt, unsigned digits)
+{
+  (void)digits;
+  return calout(ret, dt, 0);
+}
+
+size_t sd_gregout(char *ret, intdate const *dt, unsigned digits)
+{
+  (void)digits;
+  return calout(ret, dt, 1);
+}
+
+static char *putday(char *, char, uint64_t, unsigned, unsigned);
+static char *puttod(char *, uint32_t);
+
+static size_t calout(char *ret, intdate const *dt, bool gregp)
+{
+  unsigned month, day, yday;
+  uint64_t year = tocivil(dt->sec / 86400UL, gregp, &month, &day, &yday);
+  char *pos = putday(ret, gregp ? '-' : '=', year, month, day);
+  pos = puttod(pos, (uint32_t)(dt->sec % 86400UL));
+  *pos = 0;
+  return (size_t)(pos - ret);
+}
+
+/* putday: the date part of a calendar date, up to and including the T */
+static char *putday(char *pos, char sep, uint64_t year, unsigned month,
+    unsigned day)
+{
+  pos = putdec(pos, year, 4);
+  *pos++ = sep;
+  pos = put2(pos, month);
+  *pos++ = sep;
+  pos = put2(pos, day);
+  *pos++ = 'T';
+  return pos;
+}
+
+/* puttod: tod seconds into the day, as hh:mm:ss */
+static char *puttod(char *pos, uint32_t tod)
+{
+  pos = put2(pos, tod / 3600);
+  *pos++ = ':';
+  pos = put2(pos, tod / 60 % 60);
+  *pos++ = ':';
+  return put2(pos, tod % 60);
+}
+
+static void qcday(uint32_t, uint32_t, unsigned *, unsigned *, uint32_t *);
+
+/* qcsplit: the quadcent year, month and day of a date, and the quadcent *
+ * seconds into the day                                                 */
+static uint64_t qcsplit(intdate const *dt, unsigned *month, unsigned *day,
+    uint32_t *tod)
+{
+  uint64_t year, rem;
+  bool neg;
+  year = split(dt->sec, qcepoch, QCYEAR, &neg, &rem);
+  qcday((uint32_t)rem, dt->frac, month, day, tod);
+  return neg ? 323 - year : 323 + year;
+}
+
+/* qcnear: the same, given the Gregorian year of the date.  Quadcent    *
+ * years start within two days of the Gregorian ones, so the quadcent   *
+ * year is the Gregorian year or one either side of it, and is found    *
+ * without dividing.  The arithmetic wraps round, but the time into the *
+ * year it guesses is still right, as a signed number.                  */
+static uint64_t qcnear(intdate const *dt, uint64_t gyear, unsigned *month,
+    unsigned *day, uint32_t *tod)
+{
+  uint64_t rem = dt->sec - (qcepoch + (gyear - 323) * QCYEAR);
+  if(rem >> 63) {
+    gyear--;
+    rem += QCYEAR;
+  } else if(rem >= QCYEAR) {
+    gyear++;
+    rem -= QCYEAR;
+  }
+  qcday((uint32_t)rem, dt->frac, month, day, tod);
+  return gyear;
+}
+
+/* qcday: the quadcent month and day, and seconds into the day, of nsec *
+ * real seconds and frac into the quadcent year                         */
+static void qcday(uint32_t nsec, uint32_t frac, unsigned *month, unsigned *day,
+    uint32_t *tod)
+{
+  uint64_t h, l;
+  /* We need to translate the nsec:frac value (real seconds up to *
+   * 31556952:0) into quadcent seconds.  This can be done by          *
+   * multiplying by 146000 and dividing by 146097.  Normally this     *
+   * would overflow, so we do this in two parts.                      */
+  h = (uint64_t)nsec * 146000UL;
+  l = (uint64_t)frac * 146000UL;
+  h += (uint32_t)(l >> 32);
+  nsec = (uint32_t)(h / 146097UL);
+  frommarch((nsec / 86400 + 306) % 365, month, day);
+  *tod = nsec % 86400UL;
+}
+
+size_t sd_qcout(char *ret, intdate const *dt, unsigned digits)
+{
+  unsigned month, day;
+  uint32_t tod;
+  uint64_t year = qcsplit(dt, &month, &day, &tod);
+  char *pos = putday(ret, '*', year, month, day);
+  (void)digits;
+  pos = puttod(pos, tod);
+  *pos = 0;
+  return (size_t)(pos - ret);
+}
+
+static char *putunix(char *, intdate const *, bool);
+
+size_t sd_unixdout(char *ret, intdate const *dt, unsigned digits)
+{
+  char *pos = putunix(ret, dt, 0);
+  (void)digits;
+  *pos = 0;
+  return (size_t)(pos - ret);
+}
+
+size_t sd_unixxout(char *ret, intdate const *dt, unsigned digits)
+{
+  char *pos = putunix(ret, dt, 1);
+  (void)digits;
+  *pos = 0;
+  return (size_t)(pos - ret);
+}
+
+/* putunix: the Unix time of dt, in decimal or hexadecimal */
+static char *putunix(char *pos, intdate const *dt, bool hex)
+{
+  uint64_t rem;
+  bool neg;
+  uint64_t mag = split(dt->sec, unixepoch, 1, &neg, &rem);
+  *pos++ = 'U';
+  if(neg)
+    *pos++ = '-';
+  if(hex) {
+    *pos++ = '0';
+    *pos++ = 'x';
+    return puthex(pos, mag);
+  }
+  return putdec(pos, mag, 1);
+}
+
+/* Several formats at once.  The day number and time of day are found  *
+ * once, and the Gregorian and Julian dates both come from that day     *
+ * number.  The Gregorian date is found once for it, the new calc       *
+ * stardate, which is counted from its year, and the quadcent date,     *
+ * whose year is then found by qcnear() without dividing.  The time of  *
+ * day is written out once for the Gregorian and Julian dates.  The     *
+ * stardate and the Unix times have nothing to share: they are counted  *
+ * in seconds, or issues that are not whole days, from their epochs.    */
+size_t sd_multiout(char *ret, intdate const *dt, char const *fmts,
+    unsigned const *digits)
+{
+  char *pos = ret, *at;
+  uint64_t days = dt->sec / 86400UL, year, gyear = 0;
+  uint32_t tod = (uint32_t)(dt->sec % 86400UL), qtod;
+  unsigned month, day, yday, gmonth = 0, gday = 0, gyday = 0;
+  char hms[8];
+  bool greg = 0, hmsp = 0;
+  struct sdparts p;
+  for(; *fmts; fmts++, digits++) {
+    at = pos;
+    if(pos != ret)
+      *pos++ = ' ';
+    if((*fmts == 'n' || *fmts == 'g' || *fmts == 'q') && !greg) {
+      gyear = tocivil(days, 1, &gmonth, &gday, &gyday);
+      greg = 1;
+    }
+    if((*fmts == 'j' || *fmts == 'g') && !hmsp) {
+      puttod(hms, tod);
+      hmsp = 1;
+    }
+    switch(*fmts) {
+      case 's':
+	sdsplit(&p, dt);
+	pos = putsd(pos, &p, *digits);
+	break;
+      case 'n':
+	pos = putnewcalc(pos, dt, gyear, gyday, *digits);
+	break;
+      case 'j':
+	year = tocivil(days, 0, &month, &day, &yday);
+	pos = putday(pos, '=', year, month, day);
+	memcpy(pos, hms, 8);
+	pos += 8;
+	break;
+      case 'g':
+	pos = putday(pos, '-', gyear, gmonth, gday);
+	memcpy(pos, hms, 8);
+	pos += 8;
+	break;
+      case 'q':
+	year = qcnear(dt, gyear, &month, &day, &qtod);
+	pos = putday(pos, '*', year, month, day);
+	pos = puttod(pos, qtod);
+	break;
+      case 'u':
+      case 'x':
+	pos = putunix(pos, dt, *fmts == 'x');
+	break;
+      default:
+	pos = at;  /* not a format */
+	break;
+    }
+  }
+  *pos = 0;
+  return (size_t)(pos - ret);
+}
+
+/* Stepping.  Over a span of time in which a format's output is a     *
+ * linear function of the time -- an issue of stardates within one     *
+ * piece of the table, a Gregorian year of new calc stardates, or a    *
+ * quadcent year -- the position in it is x = t*a, for t the time into *
+ * the span, and the output depends on x/d.  The quotient and the      *
+ * remainder are carried from one date to the next, and a step in x    *
+ * that was taken recently is divided from memory, so that a run of    *
+ * dates a fixed step apart needs no division until the span ends.     *
+ * The text of the last whole unit of a stardate, or the last day of a  *
+ * calendar date, is kept to be copied for the next.                    */
+
+static void stepspan(struct sd_stepper *, intdate const *);
+static inline void stepto(struct sd_stepper *, intdate const *);
+
+void sd_stepinit(struct sd_stepper *st, char fmt, unsigned digits)
+{
+  memset(st, 0, sizeof(*st));
+  st->fmt = fmt;
+  st->digits = digits > 6 ? 6 : digits;
+  st->day = UINT64_MAX;
+}
+
+size_t sd_stepout(char *ret, struct sd_stepper *st, intdate const *dt)
+{
+  char *pos = ret;
+  uint64_t days, year;
+  unsigned month, day, yday;
+  struct sdparts p;
+  switch(st->fmt) {
+    case 's':
+      stepto(st, dt);
+      if(st->q / 1000000U != st->day) {
+	st->day = st->q / 1000000U;
+	sdunits(&p, &sdsegs[st->seg], st->neg, st->base, st->q);
+	st->daylen = (size_t)(putsd(st->daybuf, &p, 0) - st->daybuf);
+      }
+      memcpy(pos, st->daybuf, SD_BUFSIZE);
+      pos += st->daylen;
+      if(st->digits)
+	pos = putfrac(pos, (uint32_t)(st->q % 1000000U), st->digits);
+      break;
+    case 'n':
+      stepto(st, dt);
+      pos = newcalcq(pos, st->base, st->q,
+	  st->r << 32 | ((uint64_t)dt->frac * st->a & 0xffffffffU), st->digits);
+      break;
+    case 'j':
+    case 'g':
+      days = dt->sec / 86400UL;
+      if(days != st->day) {
+	year = tocivil(days, st->fmt == 'g', &month, &day, &yday);
+	st->daylen = (size_t)(putday(st->daybuf, st->fmt == 'g' ? '-' : '=',
+	    year, month, day) - st->daybuf);
+	st->day = days;
+      }
+      memcpy(pos, st->daybuf, SD_BUFSIZE);
+      pos = puttod(pos + st->daylen, (uint32_t)(dt->sec % 86400UL));
+      break;
+    case 'q':
+      stepto(st, dt);
+      if(st->q / 86400U != st->day) {
+	st->day = st->q / 86400U;
+	frommarch((unsigned)(st->day + 306) % 365, &month, &day);
+	st->daylen = (size_t)(putday(st->daybuf, '*', st->base, month, day) -
+	    st->daybuf);
+      }
+      memcpy(pos, st->daybuf, SD_BUFSIZE);
+      pos = puttod(pos + st->daylen, (uint32_t)(st->q % 86400U));
+      break;
+    case 'u':
+    case 'x':
+      pos = putunix(pos, dt, st->fmt == 'x');
+      break;
+  }
+  *pos = 0;
+  return (size_t)(pos - ret);
+}
+
+/* stepto: move st's position on to dt, from the last date if dt is in *
+ * the same span and no earlier                                        */
+static inline void stepto(struct sd_stepper *st, intdate const *dt)
+{
+  uint64_t x, dx;
+  unsigned i;
+  if(dt->sec < st->start || dt->sec >= st->end) {
+    stepspan(st, dt);
+    return;
+  }
+  x = (dt->sec - st->start) * st->a + ((uint64_t)dt->frac * st->a >> 32);
+  if(x < st->x) {
+    st->x = x;
+    st->q = x / st->d;
+    st->r = x % st->d;
+    return;
+  }
+  dx = x - st->x;
+  for(i = 0; i < 2 && st->dx[i] != dx; i++)
+    ;
+  if(i == 2) {
+    i = st->next;
+    st->next ^= 1;
+    st->dx[i] = dx;
+    st->dq[i] = dx / st->d;
+    st->dr[i] = dx % st->d;
+  }
+  st->x = x;
+  st->q += st->dq[i];
+  st->r += st->dr[i];
+  if(st->r >= st->d) {
+    st->r -= st->d;
+    st->q++;
+  }
+}
+
+/* stepspan: find the span that dt is in, and its position there.  The *
+ * spans are those of sdto(), putnewcalc() and qcsplit().  The steps     *
+ * remembered were divided by the last span's d, so are forgotten.       */
+static void stepspan(struct sd_stepper *st, intdate const *dt)
+{
+  struct sdseg const *s;
+  uint64_t rem, len, days;
+  unsigned n, month, day, yday;
+  bool neg;
+  switch(st->fmt) {
+    case 's':
+      for(n = TNGSEG; n; n--)
+	if(dt->sec >= sdsegs[n].sec)
+	  break;
+      s = &sdsegs[n];
+      st->seg = n;
+      st->base = split(dt->sec, s->sec, s->issuesecs, &neg, &rem);
+      st->neg = neg;
+      st->a = s->mul;
+      st->d = s->div;
+      len = s->issuesecs;
+      st->start = dt->sec - rem;
+      if(n < TNGSEG && sdsegs[n + 1].sec - st->start < len)
+	len = sdsegs[n + 1].sec - st->start;
+      break;
+    case 'n':
+      days = dt->sec / 86400UL;
+      st->base = tocivil(days, 1, &month, &day, &yday);
+      len = (gleapyear(st->base) ? 366U : 365U) * UINT64_C(86400);
+      st->start = (days - yday) * 86400UL;
+      st->a = powers10[3 + st->digits];
+      st->d = (uint32_t)len;
+      break;
+    default:  /* 'q' */
+      st->base = split(dt->sec, qcepoch, QCYEAR, &neg, &rem);
+      st->base = neg ? 323 - st->base : 323 + st->base;
+      len = QCYEAR;
+      st->start = dt->sec - rem;
+      st->a = 146000UL;
+      st->d = 146097UL;
+      break;
+  }
+  st->day = UINT64_MAX;
+  st->end = st->start > UINT64_MAX - len ? UINT64_MAX : st->start + len;
+  memset(st->dx, 0, sizeof(st->dx));
+  memset(st->dq, 0, sizeof(st->dq));
+  memset(st->dr, 0, sizeof(st->dr));
+  st->x = (dt->sec - st->start) * st->a + ((uint64_t)dt->frac * st->a >> 32);
+  st->q = st->x / st->d;
+  st->r = st->x % st->d;
+}
+
+/* Batch conversions.  Dates are converted SDBLOCK at a time.  The      *
+ * calendar arithmetic for a block is done by loops of fixed length     *
+ * over 32-bit lanes, with no branches, which compilers turn into       *
+ * vector code at ordinary optimisation levels.  A block containing a   *
+ * date too far from the epoch for 32-bit arithmetic is converted one   *
+ * date at a time instead.                                              */
+
+#define SDBLOCK 64
+
+/* The most days, and years, that the 32-bit lanes can hold. */
+#define BLOCKDAYS 0xfff00000UL
+#define BLOCKYEARS 10000000UL
+
+void sd_unixinv(int64_t const *unixsec, intdate *dt, size_t n)
+{
+  size_t i;
+  for(i = 0; i < n; i++) {
+    dt[i].sec = unixepoch + (uint64_t)unixsec[i];
+    dt[i].frac = 0;
+  }
+}
+
+void sd_unixoutv(intdate const *dt, int64_t *unixsec, size_t n)
+{
+  size_t i;
+  for(i = 0; i < n; i++)
+    unixsec[i] = (int64_t)(dt[i].sec - unixepoch);
+}
+
+/* calstatus: the status that calin() would give for these fields,   *
+ * leaving aside the year being too large.  The day is checked against *
+ * the length of the month last, as calin() does.  Months are 30 days  *
+ * long, plus one in alternate months, with the alternation changing   *
+ * over in August, except for February.                                */
+static unsigned calstatus(uint32_t leap, uint32_t month, uint32_t day,
+    uint32_t hour, uint32_t min, uint32_t sec)
+{
+  uint32_t len = month == 2 ? 28 + leap : 30 + ((month ^ (month >> 3)) & 1);
+  unsigned st = day > len ? SD_EDAY : SD_OK;
+  st = sec > 59 ? SD_ESECOND : st;
+  st = min > 59 ? SD_EMINUTE : st;
+  st = hour > 23 ? SD_EHOUR : st;
+  st = !day || day > 31 ? SD_EDAY : st;
+  return !month || month > 12 ? SD_EMONTH : st;
+}
+
+static size_t calinv(struct sd_calcols const *c, intdate *dt,
+    unsigned char *status, size_t n, bool gregp)
+{
+  uint32_t y[SDBLOCK], mo[SDBLOCK], d[SDBLOCK], tod[SDBLOCK];
+  uint32_t days[SDBLOCK], st[SDBLOCK];
+  size_t b, m, i, nok = 0;
+  for(b = 0; b < n; b += m) {
+    bool far = 0;
+    m = n - b < SDBLOCK ? n - b : SDBLOCK;
+    for(i = 0; i < m; i++)
+      far |= c->year[b+i] >= BLOCKYEARS;
+    if(far) {
+      for(i = 0; i < m; i++) {
+	uint64_t year = c->year[b+i], sec;
+	unsigned s = calstatus(gregp ? gleapyear(year) : jleapyear(year),
+	    c->month[b+i], c->day[b+i], c->hour[b+i], c->min[b+i], c->sec[b+i]);
+	if(s == SD_OK && !wsec(civil(year, c->month[b+i], c->day[b+i],
+	    c->hour[b+i]*3600U + c->min[b+i]*60U + c->sec[b+i], gregp), &sec))
+	  s = SD_ERANGE;
+	if(s == SD_OK) {
+	  dt[b+i].sec = sec;
+	  dt[b+i].frac = 0;
+	  nok++;
+	}
+	if(status)
+	  status[b+i] = (unsigned char)s;
+      }
+      continue;
+    }
+    for(i = 0; i < SDBLOCK; i++) {
+      bool in = i < m;
+      y[i] = in ? (uint32_t)c->year[b+i] : 0;
+      mo[i] = in ? c->month[b+i] : 1;
+      d[i] = in ? c->day[b+i] : 1;
+      tod[i] = in ? c->hour[b+i]*3600U + c->min[b+i]*60U + c->sec[b+i] : 0;
+      /* 29 February is checked against the year below */
+      st[i] = in ? calstatus(1, mo[i], d[i], c->hour[b+i], c->min[b+i],
+	  c->sec[b+i]) : SD_OK;
+    }
+    /* The years are offset by one leap year cycle, so that January and *
+     * February of year 0 don't need a year -1; the offset is taken off  *
+     * again below.                                                      */
+    if(gregp)
+      for(i = 0; i < SDBLOCK; i++) {
+	uint32_t yy = y[i] + 400 - (mo[i] <= 2);
+	uint32_t era = yy / 400, yoe = yy - era * 400;
+	uint32_t mp = mo[i] > 2 ? mo[i] - 3 : mo[i] + 9;
+	uint32_t leap = (y[i] % 4 == 0) & ((y[i] % 100 != 0) | (y[i] % 400 == 0));
+	days[i] = era * 146097 + 365*yoe + yoe/4 - yoe/100 + (153*mp + 2)/5 +
+	    d[i] - 1;
+	st[i] = st[i] == SD_OK && mo[i] == 2 && d[i] == 29 && !leap ?
+	    SD_EDAY : st[i];
+      }
+    else
+      for(i = 0; i < SDBLOCK; i++) {
+	uint32_t yy = y[i] + 4 - (mo[i] <= 2);
+	uint32_t era = yy / 4, yoe = yy - era * 4;
+	uint32_t mp = mo[i] > 2 ? mo[i] - 3 : mo[i] + 9;
+	uint32_t leap = y[i] % 4 == 0;
+	days[i] = era * 1461 + 365*yoe + (153*mp + 2)/5 + d[i] - 1;
+	st[i] = st[i] == SD_OK && mo[i] == 2 && d[i] == 29 && !leap ?
+	    SD_EDAY : st[i];
+      }
+    for(i = 0; i < m; i++) {
+      uint64_t off = gregp ? GMAR0 + 146097U : JMAR0 + 1461U;
+      if(st[i] == SD_OK && days[i] < off)
+	st[i] = SD_ERANGE;  /* before the internal epoch */
+      if(st[i] == SD_OK) {
+	dt[b+i].sec = ((uint64_t)days[i] - off) * 86400U + tod[i];
+	dt[b+i].frac = 0;
+	nok++;
+      }
+      if(status)
+	status[b+i] = (unsigned char)st[i];
+    }
+  }
+  return nok;
+}
+
+size_t sd_greginv(struct sd_calcols const *c, intdate *dt,
+    unsigned char *status, size_t n)
+{
+  return calinv(c, dt, status, n, 1);
+}
+
+size_t sd_julinv(struct sd_calcols const *c, intdate *dt,
+    unsigned char *status, size_t n)
+{
+  return calinv(c, dt, status, n, 0);
+}
+
+static void caloutv(intdate const *dt, struct sd_calcols const *c, size_t n,
+    bool gregp)
+{
+  uint32_t days[SDBLOCK], tod[SDBLOCK], y[SDBLOCK];
+  uint8_t mo[SDBLOCK], d[SDBLOCK];
+  size_t b, m, i;
+  for(b = 0; b < n; b += m) {
+    bool far = 0;
+    m = n - b < SDBLOCK ? n - b : SDBLOCK;
+    for(i = 0; i < SDBLOCK; i++) {
+      uint64_t dd = i < m ? dt[b+i].sec / 86400U : 0;
+      far |= dd >= BLOCKDAYS;
+      days[i] = (uint32_t)dd;
+      tod[i] = i < m ? (uint32_t)(dt[b+i].sec % 86400U) : 0;
+    }
+    if(far) {
+      for(i = 0; i < m; i++) {
+	unsigned month, day, yday;
+	c->year[b+i] = tocivil(dt[b+i].sec / 86400U, gregp, &month, &day, &yday);
+	mo[i] = (uint8_t)month;
+	d[i] = (uint8_t)day;
+      }
+    } else {
+      if(gregp)
+	for(i = 0; i < SDBLOCK; i++) {
+	  uint32_t z = days[i] + GMAR0;
+	  uint32_t era = z / 146097, doe = z - era * 146097;
+	  uint32_t yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+	  uint32_t doy = doe - (365*yoe + yoe/4 - yoe/100);
+	  uint32_t mp = (5*doy + 2) / 153;
+	  d[i] = (uint8_t)(doy - (153*mp + 2)/5 + 1);
+	  mo[i] = (uint8_t)(mp < 10 ? mp + 3 : mp - 9);
+	  y[i] = era * 400 + yoe + (mp >= 10);
+	}
+      else
+	for(i = 0; i < SDBLOCK; i++) {
+	  uint32_t z = days[i] + JMAR0;
+	  uint32_t era = z / 1461, doe = z - era * 1461;
+	  uint32_t yoe = (doe - doe/1460) / 365;
+	  uint32_t doy = doe - 365*yoe;
+	  uint32_t mp = (5*doy + 2) / 153;
+	  d[i] = (uint8_t)(doy - (153*mp + 2)/5 + 1);
+	  mo[i] = (uint8_t)(mp < 10 ? mp + 3 : mp - 9);
+	  y[i] = era * 4 + yoe + (mp >= 10);
+	}
+      for(i = 0; i < m; i++)
+	c->year[b+i] = y[i];
+    }
+    memcpy(c->month + b, mo, m);
+    memcpy(c->day + b, d, m);
+    for(i = 0; i < SDBLOCK; i++) {
+      d[i] = (uint8_t)(tod[i] / 3600);
+      mo[i] = (uint8_t)(tod[i] / 60 % 60);
+      tod[i] %= 60;
+    }
+    memcpy(c->hour + b, d, m);
+    memcpy(c->min + b, mo, m);
+    for(i = 0; i < m; i++)
+      c->sec[b+i] = (uint8_t)tod[i];
+  }
+}
+
+void sd_gregoutv(intdate const *dt, struct sd_calcols const *c, size_t n)
+{
+  caloutv(dt, c, n, 1);
+}
+
+void sd_juloutv(intdate const *dt, struct sd_calcols const *c, size_t n)
+{
+  caloutv(dt, c, n, 0);
+}
+
+void sd_qcoutv(intdate const *dt, struct sd_calcols const *c, size_t n)
+{
+  size_t i;
+  for(i = 0; i < n; i++) {
+    unsigned month, day;
+    uint32_t tod;
+    c->year[i] = qcsplit(&dt[i], &month, &day, &tod);
+    c->month[i] = (uint8_t)month;
+    c->day[i] = (uint8_t)day;
+    c->hour[i] = (uint8_t)(tod / 3600);
+    c->min[i] = (uint8_t)(tod / 60 % 60);
+    c->sec[i] = (uint8_t)(tod % 60);
+  }
+}
+
+void sd_sdoutv(intdate const *dt, struct sd_sdcols const *c, size_t n)
+{
+  struct sdparts p;
+  size_t i;
+  for(i = 0; i < n; i++) {
+    sdsplit(&p, &dt[i]);
+    c->issue[i] = p.isneg ? -(int64_t)p.nissue : (int64_t)p.nissue;
+    c->units[i] = p.integer;
+    c->frac[i] = p.frac6;
+  }
+}
@@ -0,0 +1,42 @@
+/*
+ *  refstardate: a reference build of libstardate, for verify_stardate
+ *
+ *  This compiles the libstardate.c and stardate.h of another revision,
+ *  which the Makefile extracts into ref/, with the functions that
+ *  verify_stardate compares renamed from sd_* to ref_sd_*, so that the
+ *  two builds of the library can be linked into one program.
+ */
+
+#define sd_sdin ref_sd_sdin
+#define sd_newcalcin ref_sd_newcalcin
+#define sd_julin ref_sd_julin
+#define sd_gregin ref_sd_gregin
+#define sd_qcin ref_sd_qcin
+#define sd_unixin ref_sd_unixin
+#define sd_sdout ref_sd_sdout
+#define sd_newcalcout ref_sd_newcalcout
+#define sd_julout ref_sd_julout
+#define sd_gregout ref_sd_gregout
+#define sd_qcout ref_sd_qcout
+#define sd_unixdout ref_sd_unixdout
+#define sd_unixxout ref_sd_unixxout
+
+/* and the rest, which aren't compared, just to keep them out of the way */
+#define sd_strerror ref_sd_strerror
+#define sd_classify ref_sd_classify
+#define sd_classifyn ref_sd_classifyn
+#define sd_anyin ref_sd_anyin
+#define sd_anyinn ref_sd_anyinn
+#define sd_unixinv ref_sd_unixinv
+#define sd_unixoutv ref_sd_unixoutv
+#define sd_greginv ref_sd_greginv
+#define sd_julinv ref_sd_julinv
+#define sd_gregoutv ref_sd_gregoutv
+#define sd_juloutv ref_sd_juloutv
+#define sd_qcoutv ref_sd_qcoutv
+#define sd_sdoutv ref_sd_sdoutv
+#define sd_multiout ref_sd_multiout
+#define sd_stepinit ref_sd_stepinit
+#define sd_stepout ref_sd_stepout
+
+#include "ref/libstardate.c"
@@ -56,78 +56,162 @@
  *  Input and output can be in any of these formats.
  */
 
-#include <ctype.h>
+#define _POSIX_C_SOURCE 200809L
+
 #include <errno.h>
-#include <inttypes.h>
-#include <limits.h>
+#include <pthread.h>
 #include <stdbool.h>
-#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#ifdef __linux__
+# include <sys/epoll.h>
+#else
+# include <poll.h>
+#endif
 
-/* for convenience (isxxx() want an unsigned char input) */
+#include "stardate.h"
 
-#define ISDIGIT(c) isdigit((unsigned char)(c))
-#define ISALNUM(c) isalnum((unsigned char)(c))
+/* The conversions themselves are done by libstardate; see stardate.h. */
 
-/* Internal date format: an extended Unix-style date format.
- * This consists of the number of seconds since 0001=01=01 stored in a
- * 64 bit type, plus an additional 32 bit fraction of a second.
- * Each of the date formats used for I/O has a pair of functions,
- * used for converting from/to the internal format.
- */
+/* Where the results of converting dates go: the output lines to out, *
+ * and the error messages to err.  Normally the output is written to   *
+ * stdout whenever the buffer fills, and messages straight to stderr;   *
+ * a growing sink instead keeps both, for the parallel mode to write    *
+ * out in order later.                                                  */
+struct sink {
+  char *out, *err;
+  size_t outlen, outsize, errlen, errsize;
+  bool grow;
+  struct cache *cache;  /* the conversion cache to use, if any (-C) */
+  struct stats *stats;  /* and the statistics to count in (-m) */
+  struct hist *hist;    /* and the buckets to count dates in (-a) */
+};
 
-typedef struct {
-  uint64_t sec; /* seconds since 0001=01=01; unlimited range */
-  uint32_t frac; /* range 0-(2^32-1) */
-} intdate;
+/* The kinds of binary record, for -I and -O */
+enum binkind { BIN_NONE, BIN_INTDATE, BIN_UNIX, BIN_SD, BIN_GREG, BIN_JUL };
 
 static void getcurdate(intdate *);
-static void output(intdate const *);
-
-static unsigned sdin(char const *, intdate *);
-static unsigned newcalcin(char const *, intdate *);
-static unsigned julin(char const *, intdate *);
-static unsigned gregin(char const *, intdate *);
-static unsigned qcin(char const *, intdate *);
-static unsigned unixin(char const *, intdate *);
-
-static char const *sdout(intdate const *);
-static char const *newcalcout(intdate const *);
-static char const *julout(intdate const *);
-static char const *gregout(intdate const *);
-static char const *qcout(intdate const *);
-static char const *unixdout(intdate const *);
-static char const *unixxout(intdate const *);
+static bool convert(char const *, char const *, struct sink *);
+static bool convinput(FILE *, char const *);
+static bool convfile(FILE *, char const *);
+static bool convfilepar(FILE *, char const *);
+static bool convmappar(char const *, char const *, char const *);
+static bool range(char **);
+static bool query(char **);
+static bool serve(char const *);
+static bool watch(unsigned long);
+static void output(intdate const *, struct sink *);
+static void report(struct sink *, char const *, char const *);
+static void reportn(struct sink *, char const *, char const *, size_t);
+static void outflush(void);
+static void reserve(char **, size_t *, size_t, size_t);
+static char *sinkspace(struct sink *, size_t);
+static void sinkput(struct sink *, char const *, size_t);
+static bool parsecols(char const *);
+static enum binkind parsebin(char const *, enum binkind);
+static bool convbin(FILE *, char const *);
+static void packdates(intdate const *, size_t, unsigned char *);
+static struct cache *newcache(size_t);
+static char *convat(char *, char const *, char const *, struct sink *,
+    unsigned *);
+static char *putcached(char *, intdate const *, struct sink *);
+static void cachestats(void);
+static struct stats *newstats(void);
+static unsigned parse(char const *, size_t, intdate *, struct stats *);
+static void statspoll(void);
+static void statsreport(void);
+static void waitidle(void);
+static struct aggkind const *parseagg(char const *);
+static struct hist *newhist(void);
+static void histreport(void);
+static void *xrealloc(void *, size_t);
 
 static struct format {
   char opt;
   bool sel;
-  unsigned (*in)(char const *, intdate *);
-  char const *(*out)(intdate const *);
+  unsigned digits;
+  size_t (*out)(char *, intdate const *, unsigned);
 } formats[] = {
-  { 's', 0, sdin,      sdout      },
-  { 'n', 0, newcalcin, newcalcout },
-  { 'j', 0, julin,     julout     },
-  { 'g', 0, gregin,    gregout    },
-  { 'q', 0, qcin,      qcout      },
-  { 'u', 0, unixin,    unixdout   },
-  { 'x', 0, NULL,      unixxout   },
-  { 0, 0, NULL, NULL }
+  { 's', 0, 2, sd_sdout      },
+  { 'n', 0, 2, sd_newcalcout },
+  { 'j', 0, 0, sd_julout     },
+  { 'g', 0, 0, sd_gregout    },
+  { 'q', 0, 0, sd_qcout      },
+  { 'u', 0, 0, sd_unixdout   },
+  { 'x', 0, 0, sd_unixxout   },
+  { 0, 0, 0, NULL }
 };
 
-static unsigned sddigits = 2;
-static unsigned newcalcdigits = 2;
+static void outputf(intdate const *, struct format const *, struct sink *);
+static char *putdate(char *, intdate const *, struct format const *,
+    struct stats *);
+
+#define NFORMATS (sizeof(formats) / sizeof(*formats) - 1)
+
+/* The range mode's steppers, one for each format, which carry each *
+ * date's conversion on from the last; see sd_stepinit().           */
+static struct sd_stepper steppers[NFORMATS];
+
+/* The most threads that -P will start */
+#define MAXTHREADS 256
+
+/* The size of the output buffer, and the most one line of dates needs */
+#define OUTBUFSIZE 65536
+#define OUTLINEMAX (8 * SD_BUFSIZE)
+
+/* The longest period for -w, in milliseconds: a day */
+#define MAXWATCH 86400000UL
+
+/* The most entries that -C will keep */
+#define MAXCACHE (1UL << 20)
+
+/* The most lines -i can space the index entries */
+#define MAXSPACING (1UL << 30)
 
 static char const *progname;
+static unsigned nthreads = 1;
+static struct sink stdsink;
+static bool carry;  /* use the steppers; only when single-threaded */
+static bool colmode;  /* -c: convert columns, not whole lines */
+static enum binkind binin, binout;
+static char delim = ',';
+static size_t ncache;  /* -C: entries in each conversion cache, or 0 */
+static bool statson;  /* -m: keep statistics */
+static unsigned long spacing;  /* -i: lines between index entries, or 0 */
+static struct aggkind const *agg;  /* -a: how to bucket dates, or NULL */
+
+/* optval: the value of the option at **argvp, either the rest of its *
+ * argument or the whole of the next one, which is then used up; need *
+ * says what it is, for complaining if there is none.                 */
+static char *optval(char ***argvp, char const *need)
+{
+  char **argv = *argvp;
+  char *val = argv[0][1] ? *argv + 1 : argv[1];
+  if(!val || !*val) {
+    fprintf(stderr, "%s: -%c needs %s\n", progname, **argv, need);
+    exit(EXIT_FAILURE);
+  }
+  if(val == argv[1])
+    (*argvp)++;
+  **argvp = val + strlen(val) - 1;
+  return val;
+}
 
 int main(int argc, char **argv)
 {
   struct format *f;
-  bool sel = 0, haderr = 0;
-  char *ptr;
+  bool sel = 0, haderr = 0, fromfile = 0, ranged = 0, queried = 0;
+  unsigned long watchms = 0;
+  char *ptr, *sockpath = NULL;
   intdate dt;
   (void)argc;
   if((ptr = strrchr(*argv, '/')) || (ptr = strrchr(*argv, '\\')))
@@ -136,14 +220,145 @@ int main(int argc, char **argv)
     progname = *argv;
   if(!*progname)
     progname = "stardate";
-  while(*++argv && **argv == '-')
+  while(*++argv && **argv == '-' && argv[0][1])
     while(*++*argv) {
       if(**argv == 'v') {
 	printf("stardate 1.7.0\n");
 	exit(EXIT_SUCCESS);
       }
+      if(**argv == 'f') {
+	fromfile = 1;
+	continue;
+      }
+      if(**argv == 'm') {
+	statson = 1;
+	continue;
+      }
+      if(**argv == 'r') {
+	ranged = 1;
+	continue;
+      }
+      if(**argv == 'b') {
+	queried = 1;
+	continue;
+      }
+      if(**argv == 'i') {
+	/* -i N or -iN: index every Nth line for -b */
+	char *num = optval(&argv, "a number of lines");
+	char *end;
+	unsigned long n;
+	errno = 0;
+	n = strtoul(num, &end, 10);
+	if(*num < '0' || *num > '9' || *end || errno || !n || n > MAXSPACING) {
+	  fprintf(stderr, "%s: bad spacing of index: %s\n", progname, num);
+	  exit(EXIT_FAILURE);
+	}
+	spacing = n;
+	continue;
+      }
+      if(**argv == 'S') {
+	/* -S path or -Spath: serve requests on a socket */
+	sockpath = optval(&argv, "a socket path");
+	continue;
+      }
+      if(**argv == 'w') {
+	/* -w ms or -wms: output the current date every ms milliseconds */
+	char *num = optval(&argv, "a period");
+	char *end;
+	errno = 0;
+	watchms = strtoul(num, &end, 10);
+	if(*num < '0' || *num > '9' || *end || errno || !watchms ||
+	    watchms > MAXWATCH) {
+	  fprintf(stderr, "%s: bad period: %s\n", progname, num);
+	  exit(EXIT_FAILURE);
+	}
+	continue;
+      }
+      if(**argv == 'c') {
+	/* -c list: convert those columns of each line */
+	char *list = optval(&argv, "a list of columns");
+	if(!parsecols(list)) {
+	  fprintf(stderr, "%s: bad list of columns: %s\n", progname, list);
+	  exit(EXIT_FAILURE);
+	}
+	fromfile = 1;
+	continue;
+      }
+      if(**argv == 'd') {
+	/* -d c: the column delimiter, a single character or \t */
+	char *d = optval(&argv, "a delimiter");
+	if(!strcmp(d, "\\t"))
+	  delim = '\t';
+	else if(!d[1])
+	  delim = *d;
+	else {
+	  fprintf(stderr, "%s: bad delimiter: %s\n", progname, d);
+	  exit(EXIT_FAILURE);
+	}
+	continue;
+      }
+      if(**argv == 'I' || **argv == 'O') {
+	/* -I kind, -O kind: binary records in, or out */
+	char opt = **argv;
+	char *kind = optval(&argv, "a kind of record");
+	if(opt == 'I' ? !(binin = parsebin(kind, BIN_UNIX)) :
+	    !(binout = parsebin(kind, BIN_JUL))) {
+	  fprintf(stderr, "%s: bad kind of record for -%c: %s\n", progname,
+	      opt, kind);
+	  exit(EXIT_FAILURE);
+	}
+	if(opt == 'I')
+	  fromfile = 1;
+	continue;
+      }
+      if(**argv == 'a') {
+	/* -a kind: count the dates by bucket */
+	char *kind = optval(&argv, "a kind of bucket");
+	if(!(agg = parseagg(kind))) {
+	  fprintf(stderr, "%s: bad kind of bucket: %s\n", progname, kind);
+	  exit(EXIT_FAILURE);
+	}
+	fromfile = 1;
+	continue;
+      }
+      if(**argv == 'C') {
+	/* -C N or -CN: keep a cache of N conversions */
+	char *num = optval(&argv, "a number of entries");
+	char *end;
+	unsigned long n;
+	errno = 0;
+	n = strtoul(num, &end, 10);
+	if(*num < '0' || *num > '9' || *end || errno || !n || n > MAXCACHE) {
+	  fprintf(stderr, "%s: bad size of cache: %s\n", progname, num);
+	  exit(EXIT_FAILURE);
+	}
+	ncache = n;
+	continue;
+      }
+      if(**argv == 'P') {
+	/* -P N or -PN: the number of threads for -f */
+	char *num = optval(&argv, "a number of threads");
+	char *end;
+	unsigned long n;
+	errno = 0;
+	n = strtoul(num, &end, 10);
+	if(*num < '0' || *num > '9' || *end || errno || !n || n > MAXTHREADS) {
+	  fprintf(stderr, "%s: bad number of threads: %s\n", progname, num);
+	  exit(EXIT_FAILURE);
+	}
+	nthreads = (unsigned)n;
+	continue;
+      }
       if(**argv == 'h') {
 	printf("Usage: %s [-s[0-6]] [-n[0-6]] [-j] [-g] [-q] [-u] [-x] [-h] [-v] [date ...]\n"
+	       "       %s [options] [-P N] -f [file ...]\n"
+	       "       %s [options] -r start end step\n"
+	       "       %s [options] -S path\n"
+	       "       %s [options] [-P N] [-d C] -c list [file ...]\n"
+	       "       %s [options] [-O kind] -I kind [file ...]\n"
+	       "       %s [options] -w ms\n"
+	       "       %s [options] [-i N] -b start end [file ...]\n"
+	       "       %s [-P N] -a kind [file ...]\n"
 	       "Options:\n"
 	       "  -s[N]  Output stardate (N = decimal digits, 0-6, default 2)\n"
 	       "  -n[N]  Output TNG-style stardate, 1000 units/year from 2323\n"
@@ -153,10 +368,34 @@ int main(int argc, char **argv)
 	       "  -q     Output Quadcent calendar date\n"
 	       "  -u     Output Unix time (decimal)\n"
 	       "  -x     Output Unix time (hexadecimal)\n"
+	       "  -f     Read dates one per line from files (or stdin if none or -)\n"
+	       "  -P N   With -f, convert on N threads (1-%d)\n"
+	       "  -C N   Cache the last N or so conversions, for input that\n"
+	       "         repeats itself (up to %lu)\n"
+	       "  -r     Output every date from start to end, step apart; the step\n"
+	       "         is in seconds, or with a suffix m, h, d or u (stardate\n"
+	       "         units of 31556.952 seconds)\n"
+	       "  -S P   Serve requests (\"[options] date\" lines) on the Unix\n"
+	       "         socket P, or on stdin and stdout if P is -\n"
+	       "  -c L   Read lines of delimited columns from files (or stdin), and\n"
+	       "         convert the dates in the columns in the list L (e.g. 2,4-6)\n"
+	       "  -d C   With -c, the column delimiter (default \",\"; \\t for tab)\n"
+	       "  -I K   Read binary records of kind K (intdate, unix) from files\n"
+	       "  -O K   Write binary records of kind K (intdate, unix, sd, greg,\n"
+	       "         jul) instead of text\n"
+	       "  -w MS  Output the current date every MS milliseconds\n"
+	       "  -b     Output the lines of sorted logs (or stdin) whose leading\n"
+	       "         dates are from start to end\n"
+	       "  -i N   With -b, keep an index of every Nth line in FILE.sdx\n"
+	       "  -a K   Count the dates read from files (or stdin) by issue, unit,\n"
+	       "         or [gjq]year, [gjq]month or [gjq]day, and output the counts\n"
+	       "  -m     Keep statistics on the conversions, and report them as\n"
+	       "         JSON on stderr at exit, or on SIGUSR1\n"
 	       "  -h     Show this help\n"
 	       "  -v     Show version\n"
 	       "Input formats: [issue]number.frac, number.frac, YYYY=MM=DD, YYYY-MM-DD, YYYY*MM*DD, Unumber\n",
-	       progname);
+	       progname, progname, progname, progname, progname, progname,
+	       progname, progname, progname, MAXTHREADS, MAXCACHE);
 	exit(EXIT_SUCCESS);
       }
       for(f = formats; f->opt; f++)
@@ -167,802 +406,2444 @@ int main(int argc, char **argv)
       fprintf(stderr, "%s: bad option: -%c\n", progname, **argv);
       exit(EXIT_FAILURE);
       got:
-      if(**argv == 's' && argv[0][1] >= '0' && argv[0][1] <= '6')
-	sddigits = *++*argv - '0';
-      if(**argv == 'n' && argv[0][1] >= '0' && argv[0][1] <= '6')
-	newcalcdigits = *++*argv - '0';
+      if((**argv == 's' || **argv == 'n') &&
+	  argv[0][1] >= '0' && argv[0][1] <= '6')
+	f->digits = *++*argv - '0';
     }
   if(!sel)
     formats[0].sel = 1;
-  if(!*argv) {
-    getcurdate(&dt);
-    output(&dt);
-  } else {
-    do {
-      unsigned n = 0;
-      for(f = formats; f->opt; f++) {
-	errno = 0;
-	n = f->in ? f->in(*argv, &dt) : 0;
-	if(n)
-	  break;
+  if((binin || binout) && (colmode || sockpath)) {
+    fprintf(stderr, "%s: can't use -I or -O with -c or -S\n", progname);
+    exit(EXIT_FAILURE);
+  }
+  if(agg && (binin || binout || colmode || sockpath || ncache)) {
+    fprintf(stderr, "%s: can't use -a with -I, -O, -c, -S or -C\n", progname);
+    exit(EXIT_FAILURE);
+  }
+  if(ncache)
+    stdsink.cache = newcache(ncache);
+  if(statson)
+    stdsink.stats = newstats();
+  if(agg)
+    stdsink.hist = newhist();
+  if(watchms) {
+    if(*argv) {
+      fprintf(stderr, "%s: -w takes no dates\n", progname);
+      exit(EXIT_FAILURE);
+    }
+    haderr = !watch(watchms);
+  } else if(sockpath) {
+    if(*argv) {
+      fprintf(stderr, "%s: -S takes no dates\n", progname);
+      exit(EXIT_FAILURE);
+    }
+    haderr = !serve(sockpath);
+  } else if(ranged)
+    haderr = !range(argv);
+  else if(queried)
+    haderr = !query(argv);
+  else if(fromfile) {
+    bool (*conv)(FILE *, char const *) = binin ? convbin : convinput;
+    if(!*argv)
+      haderr |= !conv(stdin, "-");
+    for(; *argv; argv++) {
+      FILE *fp;
+      if(!strcmp(*argv, "-")) {
+	haderr |= !conv(stdin, "-");
+	continue;
       }
-      haderr |= !(n & 1);
-      if(!n)
-	fprintf(stderr, "%s: date format unrecognised: %s\n", progname, *argv);
-      else if(n == 1) {
-	if(errno) {
-	  fprintf(stderr, "%s: date is out of acceptable range: %s\n",
-	      progname, *argv);
-	  haderr = 1;
-	} else
-	  output(&dt);
+      if(!(fp = fopen(*argv, "rb"))) {
+	fprintf(stderr, "%s: %s: %s\n", progname, *argv, strerror(errno));
+	haderr = 1;
+	continue;
       }
-    } while(*++argv);
+      haderr |= !conv(fp, *argv);
+      fclose(fp);
+    }
+  } else if(!*argv) {
+    getcurdate(&dt);
+    output(&dt, &stdsink);
+  } else {
+    do
+      haderr |= !convert(*argv, *argv + strlen(*argv), &stdsink);
+    while(*++argv);
   }
+  waitidle();
+  if(agg)
+    histreport();
+  outflush();
+  if(statson)
+    statsreport();
+  else if(ncache)
+    cachestats();
   exit(haderr ? EXIT_FAILURE : EXIT_SUCCESS);
 }
 
+/* getcurdate: the current time, to the nanosecond if the clock has it; *
+ * the fraction is rounded up, as the parsers do, so that it reads back *
+ * as the same number of nanoseconds                                     */
 static void getcurdate(intdate *dt)
 {
-  time_t t = time(NULL);
-  struct tm *tm = gmtime(&t);
-  char utc[32];
-  sprintf(utc, "%04d-%02d-%02dT%02d:%02d:%02d", tm->tm_year+1900, tm->tm_mon+1,
-      tm->tm_mday, tm->tm_hour, tm->tm_min, tm->tm_sec);
-  gregin(utc, dt);
+  struct timespec ts;
+  int64_t sec;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  sec = ts.tv_sec;
+  sd_unixinv(&sec, dt, 1);
+  dt->frac = (uint32_t)((((uint64_t)ts.tv_nsec << 32) + 999999999) /
+      1000000000);
 }
 
-static void output(intdate const *dt)
+/* Watch mode.  With -w, the current date is output every period, on a *
+ * schedule of absolute deadlines on the monotonic clock, so that the   *
+ * time spent converting and writing each line, and any oversleeping,  *
+ * never accumulates into drift.  If a deadline has already gone by    *
+ * when the last line is written, it is skipped rather than caught up  *
+ * with a burst of lines.  Each line is flushed as it is written, for   *
+ * a status feed.                                                      */
+
+/* sleepuntil: sleep until the monotonic clock reaches ns */
+static void sleepuntil(uint64_t ns)
 {
-  struct format *f;
-  bool d1 = 0;
-  for(f = formats; f->opt; f++)
-    if(f->sel) {
-      if(d1)
-	putchar(' ');
-      d1 = 1;
-      fputs(f->out(dt), stdout);
-    }
-  putchar('\n');
+  struct timespec ts;
+#ifdef TIMER_ABSTIME
+  ts.tv_sec = (time_t)(ns / 1000000000);
+  ts.tv_nsec = (long)(ns % 1000000000);
+  while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    ;
+#else
+  /* No absolute sleeps: sleep for what's left, as near as possible */
+  uint64_t now;
+  for(;;) {
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+    if(now >= ns)
+      return;
+    ts.tv_sec = (time_t)((ns - now) / 1000000000);
+    ts.tv_nsec = (long)((ns - now) % 1000000000);
+    nanosleep(&ts, NULL);
+  }
+#endif
 }
 
-/* uint64str: convert a uint64_t to a string in the given radix with
- * at least `min` digits. */
-static char const *uint64str(uint64_t n, unsigned radix, unsigned min)
+static bool watch(unsigned long ms)
 {
-  static char ret[21];
-  char *pos = ret + 20;
-  char *end = pos - min;
-  *pos = 0;
-  while(n) {
-    *--pos = "0123456789abcdef"[n % radix];
-    n /= radix;
+  uint64_t period = (uint64_t)ms * 1000000, next, now;
+  struct timespec ts;
+  intdate dt;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  next = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+  for(;;) {
+    getcurdate(&dt);
+    output(&dt, &stdsink);
+    outflush();
+    if(fflush(stdout) == EOF) {
+      fprintf(stderr, "%s: can't write: %s\n", progname, strerror(errno));
+      return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+    next += period;
+    if(next <= now)
+      next += (now - next) / period * period + period;
+    sleepuntil(next);
   }
-  while(pos > end)
-    *--pos = '0';
-  return pos;
 }
 
-/* The length of one quadcent year, 12622780800 / 400 == 31556952 seconds. */
-#define QCYEAR 31556952UL
-#define STDYEAR 31536000UL
-
-/* Definitions to help with leap years. */
-static unsigned nrmdays[12]={ 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
-static unsigned lyrdays[12]={ 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
-#define jleapyear(y) ( !((y)%4L) )
-#define gleapyear(y) ( !((y)%4L) && ( ((y)%100L) || !((y)%400L) ) )
-#define jdays(y) (jleapyear(y) ? lyrdays : nrmdays)
-#define gdays(y) (gleapyear(y) ? lyrdays : nrmdays)
-#define xdays(gp, y) (((gp) ? gleapyear(y) : jleapyear(y)) ? lyrdays : nrmdays)
-
-/* The date 0323-01-01 (0323*01*01) is 117609 days after the internal   *
- * epoch, 0001=01=01 (0000-12-30).  This is a difference of             *
- * 117609*86400 (0x1cb69*0x15180) == 10161417600 (0x25daaed80) seconds. */
-static uint64_t const qcepoch = UINT64_C(0x25daaed80);
-
-/* The length of four centuries, 146097 days of 86400 seconds, is *
- * 12622780800 (0x2f0605980) seconds.                             */
-static uint64_t const quadcent = UINT64_C(0x2f0605980);
-
-/* The epoch for Unix time, 1970-01-01, is 719164 (0xaf93c) days after *
- * our internal epoch, 0001=01=01 (0000-12-30).  This is a difference  *
- * of 719164*86400 (0xaf93c*0x15180) == 62135769600 (0xe77949a00)      *
- * seconds.                                                            */
-static uint64_t const unixepoch = UINT64_C(0xe77949a00);
-
-/* The epoch for stardates, 2162-01-04, is 789294 (0xc0b2e) days after *
- * the internal epoch.  This is 789294*86400 (0xc0b2e*0x15180) ==      *
- * 68195001600 (0xfe0bd2500) seconds.                                  */
-static uint64_t const ufpepoch = UINT64_C(0xfe0bd2500);
-
-/* The epoch for TNG-style stardates, 2323-01-01, is 848094 (0xcf0de) *
- * days after the internal epoch.  This is 73275321600 (0x110f8cad00) *
- * seconds.                                                           */
-static uint64_t const tngepoch = UINT64_C(0x110f8cad00);
-
-struct caldate {
-  uint64_t year;
-  unsigned month, day;
-  unsigned hour, min, sec;
-};
-static unsigned readcal(struct caldate *, char const *, char);
-
-static unsigned sdin(char const *date, intdate *dt)
-{
-  uint64_t nissue;
-  uint32_t integer, frac;
-  char const *cptr = date;
-  char *ptr;
-  int oerrno;
-  bool negi;
-  char fracbuf[7];
-  if(*cptr++ != '[')
-    return 0;
-  negi = (*cptr == '-');
-  if(negi)
-    cptr++;
-  if(!ISDIGIT(*cptr))
-    return 0;
-  errno = 0;
-  nissue = strtoull(cptr, &ptr, 10);
-  oerrno = errno;
-  if(*ptr++ != ']' || !ISDIGIT(*ptr))
-    return 0;
-  integer = strtoul(ptr, &ptr, 10);
-  if(errno || integer > 99999UL ||
-      (!negi && nissue == 20 && integer > 5005UL) ||
-      ((negi || nissue < 20) && integer > 9999UL)) {
-    fprintf(stderr, "%s: integer part is out of range: %s\n", progname, date);
-    return 2;
-  }
-  if(*ptr == '.') {
-    char *b = fracbuf;
-    strcpy(fracbuf, "000000");
-    ptr++;
-    while(*b && ISDIGIT(*ptr))
-      *b++ = *ptr++;
-    while(ISDIGIT(*ptr))
-      ptr++;
-    if(*ptr)
-      return 0;
-  } else if(*ptr)
-    return 0;
-  frac = strtoul(fracbuf, NULL, 10);
-  errno = oerrno;
-  if(negi || nissue <= 20) {
-    /* Pre-TNG stardate */
-    uint64_t f;
-    if(!negi) {
-      /* There are two changes in stardate rate to handle: *
-       *       up to [19]7340      0.2 days/unit           *
-       * [19]7340 to [19]7840     10   days/unit           *
-       * [19]7840 to [20]5006      2   days/unit           *
-       * we scale to the first of these.                   */
-      if(nissue == 20) {
-	nissue = 19;
-	integer += 10000UL;
-	goto fiddle;
-      } else if(nissue == 19 && integer >= 7340UL) {
-	fiddle:
-	/* We have a stardate in the range [19]7340 to [19]15006.  First *
-	 * we scale it to match the prior rate, so this range changes to *
-	 * 7340 to 390640.                                               */
-	integer = 7340UL + ((integer - 7340UL) * 50) + frac / (1000000UL/50);
-	frac = (frac * 50UL) % 1000000UL;
-	/* Next, if the stardate is greater than what was originally     *
-	 * [19]7840 (now represented as 32340), it is in the 2 days/unit *
-	 * range, so scale it back again.  The range affected, 32340 to  *
-	 * 390640, changes to 32340 to 104000.                           */
-	if(integer >= 32340UL) {
-	  frac = frac/5UL + (integer%5UL) * (1000000UL/5);
-	  integer = 32340UL + (integer - 32340UL) / 5;
-	}
-	/* The odd stardate has now been scaled to match the early stardate *
-	 * type.  It could be up to [19]104000.  Fortunately this will not  *
-	 * cause subsequent calculations to overflow.                       */
-      }
-      dt->sec = ufpepoch + nissue * (uint64_t)(2000UL*86400UL);
-    } else {
-      /* Negative stardate.  In order to avoid underflow in some cases, we *
-       * actually calculate a date one issue (2000 days) too late, and     *
-       * then subtract that much as the last stage.                        */
-      dt->sec = ufpepoch - (nissue - 1) * (uint64_t)(2000UL*86400UL);
-    }
-    dt->sec += (uint64_t)(86400UL/5UL) * integer;
-    /* frac is scaled such that it is in the range 0-999999, and a value *
-     * of 1000000 would represent 86400/5 seconds.  We want to put frac  *
-     * in the top half of a uint64, multiply by 86400/5 and divide by    *
-     * 1000000, in order to leave the uint64 containing (top half) a     *
-     * number of seconds and (bottom half) a fraction.  In order to      *
-     * avoid overflow, this scaling is cancelled down to a multiply by   *
-     * 54 and a divide by 3125.                                          */
-    f = ((uint64_t)frac << 32) * 54UL;
-    f = (f + 3124UL) / 3125UL;
-    dt->sec += (uint32_t)(f >> 32);
-    dt->frac = (uint32_t)f;
-    if(negi) {
-      /* Subtract off the issue that was added above. */
-      dt->sec -= 2000UL*86400UL;
+/* convert: convert one date, in whichever input format it is in, and *
+ * output it.  Returns false if the date was not accepted (the reason  *
+ * has already been reported).  The date runs from date to end, and    *
+ * needn't be NUL-terminated.                                          */
+static bool convert(char const *date, char const *end, struct sink *sk)
+{
+  intdate dt;
+  unsigned n;
+  if(sk->cache && !binout) {
+    char *pos = convat(sinkspace(sk, OUTLINEMAX), date, end, sk, &n);
+    if(pos) {
+      *pos++ = '\n';
+      sk->outlen = (size_t)(pos - sk->out);
+      return 1;
     }
-  } else {
-    uint64_t t;
-    /* TNG stardate */
-    nissue -= 21;
-    /* Each issue is 86400*146097/4 seconds long. */
-    dt->sec = tngepoch + nissue * (uint64_t)((86400UL/4UL)*146097UL);
-    /* 1 unit is (86400*146097/4)/100000 seconds, which isn't even. *
-     * It cancels to 27*146097/125.                                 */
-    t = (uint64_t)integer * 1000000UL;
-    t += frac;
-    t *= 27UL*146097UL;
-    dt->sec += t / 125000000UL;
-    t = ((uint64_t)(t % 125000000UL) << 32);
-    t = (t + 124999999UL) / 125000000UL;
-    dt->frac = (uint32_t)t;
+  } else if((n = parse(date, (size_t)(end - date), &dt, sk->stats)) == SD_OK) {
+    output(&dt, sk);
+    return 1;
   }
-  return 1;
+  reportn(sk, sd_strerror(n), date, (size_t)(end - date));
+  return 0;
 }
 
-/* New calc: simple TNG-style stardates.
- * 1000 stardate units per Gregorian calendar year, epoch at 2323-01-01.
- * Stardate = (year - 2323) * 1000 + (day_of_year / days_in_year) * 1000.
- * Input format: a bare decimal number (no brackets), e.g. "41153.7".
- */
+/* The conversion cache.  With -C, the formatted output for dates seen   *
+ * recently is kept, so that a date that recurs is only parsed and      *
+ * formatted the first time.  It is looked up by the text of the date,  *
+ * in front of the parsers, and then by the date itself, in front of    *
+ * the formatters, which also catches a date written different ways.   *
+ * The table is open-addressed and set-associative: a key's hash picks  *
+ * a bucket of CWAYS entries, whose tags share one cache line, so that  *
+ * a lookup touches just that line and the entry it finds.  A full     *
+ * bucket evicts by the clock algorithm.  Input that doesn't repeat     *
+ * would only pay for the lookups, so a cache that almost never hits is *
+ * bypassed for a while, and then tried again.  Each thread has its own *
+ * cache, and the one on the server's connections is never used, since *
+ * requests can choose their own formats.                              */
+
+#define CWAYS 8
+#define CKEYWORDS 5         /* the longest text of a date that is kept, */
+#define CKEYMAX (8 * CKEYWORDS)  /* in words and in bytes */
+#define COUTMAX 85          /* and the longest output */
+#define CWINDOW 8192        /* lookups between checks on the hit rate */
+#define CBYPASS (1UL << 20) /* dates to bypass the cache for, if it's low */
+
+struct cbucket {
+  uint32_t tag[CWAYS];  /* of the entries, 0 if empty */
+  uint8_t ref[CWAYS];   /* the clock's reference bits */
+  uint8_t hand;         /* and where the clock is */
+  uint8_t pad[64 - 5 * CWAYS - 1];
+};
 
-static unsigned newcalcin(char const *date, intdate *dt)
+struct centry {
+  uint64_t key[CKEYWORDS];  /* padded with zeroes */
+  uint8_t keylen, outlen;
+  bool isdate;          /* the key is an intdate, not text */
+  char out[COUTMAX];
+};
+
+/* A key being looked up: its words, padded like an entry's, and hash */
+struct ckey {
+  uint64_t w[CKEYWORDS];
+  size_t len;
+  bool isdate;
+  uint64_t hash;        /* the low bits pick the bucket, the high the tag */
+};
+
+struct cache {
+  struct cbucket *buckets;
+  struct centry *entries;
+  size_t mask;          /* buckets - 1 */
+  unsigned long hits, misses, evictions;
+  unsigned long window, winhits, bypass;
+  struct cache *next;   /* all of the caches, for cachestats() */
+};
+
+static struct cache *caches;
+
+/* newcache: make a cache of about n entries, at least one bucket */
+static struct cache *newcache(size_t n)
+{
+  struct cache *c = calloc(1, sizeof(*c));
+  size_t nb = 1;
+  void *b, *e;
+  while(nb * CWAYS < n)
+    nb *= 2;
+  if(!c || posix_memalign(&b, 64, nb * sizeof(struct cbucket)) ||
+      posix_memalign(&e, 64, nb * CWAYS * sizeof(struct centry))) {
+    fprintf(stderr, "%s: out of memory\n", progname);
+    exit(EXIT_FAILURE);
+  }
+  memset(b, 0, nb * sizeof(struct cbucket));
+  c->buckets = b;
+  c->entries = e;
+  c->mask = nb - 1;
+  c->next = caches;
+  caches = c;
+  return c;
+}
+
+/* ckey: make the key for len bytes at p, which fit in CKEYMAX, and *
+ * hash it a word at a time; the tag is never 0                     */
+static void ckey(struct ckey *k, void const *p, size_t len, bool isdate)
 {
-  char *ptr;
-  char datebuf[32];
-  double sd;
-  int year;
-  double yearfrac;
-  unsigned daysinyear;
-  double daysec;
-  unsigned day, mon;
-  unsigned *mdays;
+  uint64_t h = len | (uint64_t)isdate << 8;
+  unsigned i;
+  memset(k->w, 0, sizeof(k->w));
+  memcpy(k->w, p, len);
+  k->len = len;
+  k->isdate = isdate;
+  for(i = 0; i * 8 < len; i++) {
+    h = (h ^ k->w[i]) * UINT64_C(0x9e3779b97f4a7c15);
+    h ^= h >> 29;
+  }
+  h *= UINT64_C(0xbf58476d1ce4e5b9);
+  k->hash = (h ^ h >> 31) | UINT64_C(1) << 32;
+}
 
-  /* Must start with a digit and not contain [, =, -, *, U */
-  if(!ISDIGIT(*date))
-    return 0;
-  /* Quick scan: must be digits, optionally a dot, then more digits */
-  {
-    char const *p = date;
-    while(ISDIGIT(*p)) p++;
-    if(*p == '.') {
-      p++;
-      while(ISDIGIT(*p)) p++;
-    }
-    if(*p) return 0; /* trailing junk -- not our format */
-  }
-  /* Parse the number */
-  errno = 0;
-  sd = strtod(date, &ptr);
-  if(errno || *ptr)
-    return 0;
+/* cactive: whether to use the cache for the next date */
+static bool cactive(struct cache *c)
+{
+  if(!c->bypass)
+    return 1;
+  c->bypass--;
+  return 0;
+}
 
-  /* year = 2323 + floor(sd / 1000) */
-  year = 2323 + (int)(sd / 1000.0);
-  if(sd < 0) {
-    /* For negative stardates, adjust: e.g. -500.0 -> year 2322 */
-    if(sd < 0 && (sd - (year - 2323) * 1000.0) < 0)
-      year--;
+/* clookup: copy the output for a key to pos, which has room for *
+ * COUTMAX bytes, and return its end, or NULL if it isn't cached  */
+static char *clookup(struct cache *c, struct ckey const *k, char *pos)
+{
+  size_t bi = (size_t)k->hash & c->mask;
+  struct cbucket *b = &c->buckets[bi];
+  uint32_t tag = (uint32_t)(k->hash >> 32);
+  unsigned i, w;
+  if(++c->window == CWINDOW) {
+    if(c->winhits < CWINDOW / 32)
+      c->bypass = CBYPASS;
+    c->window = c->winhits = 0;
   }
-  yearfrac = (sd - (year - 2323) * 1000.0) / 1000.0;
+  for(i = 0; i < CWAYS; i++)
+    if(b->tag[i] == tag) {
+      struct centry const *e = &c->entries[bi * CWAYS + i];
+      if(e->keylen != k->len || e->isdate != k->isdate)
+	continue;
+      for(w = 0; w < CKEYWORDS && e->key[w] == k->w[w]; w++)
+	;
+      if(w < CKEYWORDS)
+	continue;
+      b->ref[i] = 1;
+      c->hits++;
+      c->winhits++;
+      memcpy(pos, e->out, COUTMAX);
+      return pos + e->outlen;
+    }
+  c->misses++;
+  return NULL;
+}
 
-  daysinyear = gleapyear(year) ? 366 : 365;
-  daysec = yearfrac * daysinyear * 86400.0;
+/* cinsert: keep the output from out to end for a key, out having *
+ * COUTMAX bytes readable                                          */
+static void cinsert(struct cache *c, struct ckey const *k, char const *out,
+    char const *end)
+{
+  size_t bi = (size_t)k->hash & c->mask;
+  struct cbucket *b = &c->buckets[bi];
+  struct centry *e;
+  unsigned i;
+  if(end - out > COUTMAX)
+    return;
+  for(i = 0; i < CWAYS && b->tag[i]; i++)
+    ;
+  if(i == CWAYS) {
+    while(b->ref[b->hand]) {
+      b->ref[b->hand] = 0;
+      b->hand = (b->hand + 1) % CWAYS;
+    }
+    i = b->hand;
+    b->hand = (b->hand + 1) % CWAYS;
+    c->evictions++;
+  }
+  e = &c->entries[bi * CWAYS + i];
+  b->tag[i] = (uint32_t)(k->hash >> 32);
+  b->ref[i] = 0;
+  memcpy(e->key, k->w, sizeof(e->key));
+  e->keylen = (uint8_t)k->len;
+  e->outlen = (uint8_t)(end - out);
+  e->isdate = k->isdate;
+  memcpy(e->out, out, COUTMAX);
+}
 
-  /* Build a Gregorian date string and use gregin to parse it */
-  day = (unsigned)(daysec / 86400.0);
-  if(day >= daysinyear) day = daysinyear - 1;
-  daysec -= day * 86400.0;
-  if(daysec < 0) daysec = 0;
+/* putcached: putdate() in the selected formats, through the cache; *
+ * pos has room for OUTLINEMAX bytes                                 */
+static char *putcached(char *pos, intdate const *dt, struct sink *sk)
+{
+  struct cache *c = sk->cache;
+  unsigned char raw[12];
+  struct ckey k;
+  char *end;
+  if(!cactive(c))
+    return putdate(pos, dt, formats, sk->stats);
+  memcpy(raw, &dt->sec, 8);
+  memcpy(raw + 8, &dt->frac, 4);
+  ckey(&k, raw, sizeof(raw), 1);
+  if((end = clookup(c, &k, pos)))
+    return end;
+  end = putdate(pos, dt, formats, sk->stats);
+  cinsert(c, &k, pos, end);
+  return end;
+}
 
-  /* Convert day-of-year to month/day */
-  mdays = gleapyear(year) ? lyrdays : nrmdays;
-  mon = 0;
-  while(mon < 12 && day >= mdays[mon]) {
-    day -= mdays[mon];
-    mon++;
+/* convat: convert the date from date to end, and write it at pos in the *
+ * selected formats, through the sink's cache.  Returns the end, or NULL *
+ * with the status in *n if the date isn't accepted.  pos has room for  *
+ * OUTLINEMAX bytes.                                                    */
+static char *convat(char *pos, char const *date, char const *end,
+    struct sink *sk, unsigned *n)
+{
+  struct cache *c = sk->cache;
+  size_t len = (size_t)(end - date);
+  intdate dt;
+  char *out;
+  struct ckey k;
+  bool use = len <= CKEYMAX && cactive(c);
+  *n = SD_OK;
+  if(use) {
+    ckey(&k, date, len, 0);
+    if((out = clookup(c, &k, pos)))
+      return out;
   }
-  mon++; /* 1-based */
-  day++; /* 1-based */
+  if((*n = parse(date, len, &dt, sk->stats)) != SD_OK)
+    return NULL;
+  if(!use)
+    return putdate(pos, &dt, formats, sk->stats);
+  out = putcached(pos, &dt, sk);
+  cinsert(c, &k, pos, out);
+  return out;
+}
 
-  {
-    unsigned hr = (unsigned)(daysec / 3600.0);
-    unsigned mn, sc;
-    daysec -= hr * 3600.0;
-    mn = (unsigned)(daysec / 60.0);
-    daysec -= mn * 60.0;
-    sc = (unsigned)daysec;
-    if(hr > 23) hr = 23;
-    if(mn > 59) mn = 59;
-    if(sc > 59) sc = 59;
-    sprintf(datebuf, "%04d-%02d-%02dT%02d:%02d:%02d",
-	year, mon, day, hr, mn, sc);
+/* cachetotals: how well the caches did, over all the threads */
+static void cachetotals(unsigned long *hits, unsigned long *misses,
+    unsigned long *evictions)
+{
+  struct cache *c;
+  *hits = *misses = *evictions = 0;
+  for(c = caches; c; c = c->next) {
+    *hits += c->hits;
+    *misses += c->misses;
+    *evictions += c->evictions;
   }
-  return gregin(datebuf, dt);
 }
 
-static unsigned calin(char const *, intdate *, bool);
+/* cachestats: report that */
+static void cachestats(void)
+{
+  unsigned long hits, misses, evictions;
+  cachetotals(&hits, &misses, &evictions);
+  fprintf(stderr, "%s: cache: %lu hits, %lu misses, %lu evictions\n",
+      progname, hits, misses, evictions);
+}
+
+/* Statistics.  With -m, each thread counts the dates it parses, by the *
+ * format they turn out to be in, and the ones it can't, by the reason, *
+ * and the dates it writes in each output format; and one in every     *
+ * STATSAMPLE of each is timed, for the average time each takes.  The  *
+ * counters are the thread's own, so counting takes no locks, and with  *
+ * the timing sampled it costs a few nanoseconds a date.  The totals    *
+ * over all the threads are reported as one line of JSON on the         *
+ * standard error at exit, and whenever SIGUSR1 arrives, as soon as     *
+ * some output is next written.  So as not to read the counters while   *
+ * other threads are still adding to them, the report waits until the  *
+ * threads have finished the jobs they have in hand.                   */
+
+#define STATSAMPLE 64
+#define NSTATUS (SD_EUNIX + 1)
+
+/* The input formats, by sd_classify()'s letters for them */
+static char const informats[] = "snjgqu";
+#define NINFORMATS (sizeof(informats) - 1)
+
+/* What to call each status in the report */
+static char const *const statusnames[NSTATUS] = {
+  "unrecognised", "ok", "range", "integer", "month", "day", "hour",
+  "minute", "second", "time", "unix"
+};
+
+struct stats {
+  uint64_t parsed[NINFORMATS], parsefailed[NINFORMATS];
+  uint64_t parsens[NINFORMATS], parsetimed[NINFORMATS];
+  uint64_t status[NSTATUS];
+  uint64_t formatted[NFORMATS], formatns[NFORMATS], formattimed[NFORMATS];
+  struct stats *next;   /* all of them, for statsreport() */
+};
+
+static struct stats *allstats;
+static uint64_t nsbias;  /* what reading the clock twice itself takes */
+static volatile sig_atomic_t statsreq;
+
+/* nsnow: the monotonic clock, in nanoseconds */
+static uint64_t nsnow(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/* nstaken: the time since t, less the cost of timing it */
+static uint64_t nstaken(uint64_t t)
+{
+  uint64_t d = nsnow() - t;
+  return d > nsbias ? d - nsbias : 0;
+}
 
-static unsigned julin(char const *date, intdate *dt)
+static void statsignal(int sig)
 {
-  return calin(date, dt, 0);
+  (void)sig;
+  statsreq = 1;
 }
 
-static unsigned gregin(char const *date, intdate *dt)
+/* newstats: a set of counters for another thread; the first also sets *
+ * up the timing and the signal                                         */
+static struct stats *newstats(void)
 {
-  return calin(date, dt, 1);
+  struct stats *st = calloc(1, sizeof(*st));
+  if(!st) {
+    fprintf(stderr, "%s: out of memory\n", progname);
+    exit(EXIT_FAILURE);
+  }
+  if(!allstats) {
+    struct sigaction act;
+    unsigned i;
+    nsbias = UINT64_MAX;
+    for(i = 0; i < 100; i++) {
+      uint64_t t = nsnow(), d = nsnow() - t;
+      if(d < nsbias)
+	nsbias = d;
+    }
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = statsignal;
+    act.sa_flags = SA_RESTART;
+    sigemptyset(&act.sa_mask);
+    sigaction(SIGUSR1, &act, NULL);
+  }
+  st->next = allstats;
+  allstats = st;
+  return st;
 }
 
-static unsigned calin(char const *date, intdate *dt, bool gregp)
+/* parse: sd_anyinn(), counted in st if it's not null */
+static unsigned parse(char const *date, size_t len, intdate *dt,
+    struct stats *st)
 {
-  struct caldate c;
+  char const *fmt;
+  unsigned n, i;
   uint64_t t;
-  bool low;
-  unsigned cycle;
-  unsigned n = readcal(&c, date, gregp ? '-' : '=');
-  if(n != 1)
-    return n;
-  cycle = c.year % 400UL;
-  if(c.day > xdays(gregp, cycle)[c.month - 1]) {
-    fprintf(stderr, "%s: day is out of range: %s\n", progname, date);
-    return 2;
-  }
-  low = (gregp && c.year == 0);
-  if(low)
-    c.year = 399;
+  int c;
+  if(!st)
+    return sd_anyinn(date, len, dt);
+  if(!(c = sd_classifyn(date, len))) {
+    st->status[SD_NOMATCH]++;
+    return SD_NOMATCH;
+  }
+  fmt = strchr(informats, c);
+  i = (unsigned)(fmt - informats);
+  if((st->parsed[i] + st->parsefailed[i]) % STATSAMPLE) {
+    n = sd_anyinn(date, len, dt);
+  } else {
+    t = nsnow();
+    n = sd_anyinn(date, len, dt);
+    st->parsens[i] += nstaken(t);
+    st->parsetimed[i]++;
+  }
+  if(n == SD_OK)
+    st->parsed[i]++;
   else
-    c.year--;
-  t = c.year * 365UL;
-  if(gregp) {
-    t -= c.year / 100UL;
-    t += c.year / 400UL;
-  }
-  t += c.year / 4UL;
-  n = 2*(unsigned)gregp + c.day - 1;
-  for(c.month--; c.month--; )
-    n += xdays(gregp, cycle)[c.month];
-  t += n;
-  if(low)
-    t -= 146097UL;
-  t *= 86400UL;
-  dt->sec = t + (uint64_t)(c.hour*3600UL + c.min*60UL + c.sec);
-  dt->frac = 0;
-  return 1;
+    st->parsefailed[i]++;
+  st->status[n]++;
+  return n;
+}
+
+/* statsavg: the average time of the ones timed */
+static double statsavg(uint64_t ns, uint64_t timed)
+{
+  return timed ? (double)ns / (double)timed : 0;
+}
+
+/* statsreport: report the statistics, totalled over the threads */
+static void statsreport(void)
+{
+  struct stats tot;
+  struct stats const *st;
+  unsigned i, j;
+  memset(&tot, 0, sizeof(tot));
+  for(st = allstats; st; st = st->next) {
+    for(i = 0; i < NINFORMATS; i++) {
+      tot.parsed[i] += st->parsed[i];
+      tot.parsefailed[i] += st->parsefailed[i];
+      tot.parsens[i] += st->parsens[i];
+      tot.parsetimed[i] += st->parsetimed[i];
+    }
+    for(i = 0; i < NSTATUS; i++)
+      tot.status[i] += st->status[i];
+    for(i = 0; i < NFORMATS; i++) {
+      tot.formatted[i] += st->formatted[i];
+      tot.formatns[i] += st->formatns[i];
+      tot.formattimed[i] += st->formattimed[i];
+    }
+  }
+  fprintf(stderr, "{\"inputs\":{");
+  for(i = 0; i < NINFORMATS; i++)
+    fprintf(stderr, "%s\"%c\":{\"parsed\":%llu,\"failed\":%llu,\"ns\":%.1f}",
+	i ? "," : "", informats[i], (unsigned long long)tot.parsed[i],
+	(unsigned long long)tot.parsefailed[i],
+	statsavg(tot.parsens[i], tot.parsetimed[i]));
+  fprintf(stderr, "},\"errors\":{");
+  for(i = j = 0; i < NSTATUS; i++)
+    if(i != SD_OK)
+      fprintf(stderr, "%s\"%s\":%llu", j++ ? "," : "", statusnames[i],
+	  (unsigned long long)tot.status[i]);
+  fprintf(stderr, "},\"outputs\":{");
+  for(i = 0; i < NFORMATS; i++)
+    fprintf(stderr, "%s\"%c\":{\"formatted\":%llu,\"ns\":%.1f}",
+	i ? "," : "", formats[i].opt, (unsigned long long)tot.formatted[i],
+	statsavg(tot.formatns[i], tot.formattimed[i]));
+  fprintf(stderr, "}");
+  if(ncache) {
+    unsigned long hits, misses, evictions;
+    cachetotals(&hits, &misses, &evictions);
+    fprintf(stderr, ",\"cache\":{\"hits\":%lu,\"misses\":%lu,"
+	"\"evictions\":%lu}", hits, misses, evictions);
+  }
+  fprintf(stderr, ",\"sample\":%d}\n", STATSAMPLE);
+}
+
+/* statspoll: report the statistics if SIGUSR1 has asked for them */
+static void statspoll(void)
+{
+  if(statsreq) {
+    statsreq = 0;
+    waitidle();
+    statsreport();
+  }
+}
+
+/* Aggregation.  With -a, the dates read are counted in buckets instead *
+ * of being output, and at the end there is one line for each bucket,  *
+ * in order, of the bucket and its count.  Each date's bucket is found  *
+ * from its fields, split out by the library's batch conversions a     *
+ * block of dates at a time, and looked up in a hash table that holds   *
+ * one entry for each bucket, so memory grows with the number of       *
+ * buckets, not of dates.  Each thread counts in its own table, and the *
+ * tables are added together at the end.  A bucket is written as the   *
+ * first date counted in it, cut short to the fields that make it up.  */
+
+#define HISTBLOCK 256
+
+static struct aggkind {
+  char const *name;
+  char fmt;     /* which input format's fields make the bucket */
+  unsigned by;  /* issue, year, month, day */
+} const aggkinds[] = {
+  { "issue",  's', 0 },
+  { "unit",   's', 3 },
+  { "gyear",  'g', 1 },
+  { "gmonth", 'g', 2 },
+  { "gday",   'g', 3 },
+  { "jyear",  'j', 1 },
+  { "jmonth", 'j', 2 },
+  { "jday",   'j', 3 },
+  { "qyear",  'q', 1 },
+  { "qmonth", 'q', 2 },
+  { "qday",   'q', 3 },
+  { NULL, 0, 0 }
+};
+
+struct bucket {
+  uint64_t hi, lo;  /* the key, in order */
+  uint64_t count;   /* or 0 if the entry is free */
+  intdate first;
+};
+
+struct hist {
+  struct bucket *b;
+  size_t mask, n;  /* the table has mask+1 entries, n of them in use */
+  intdate pend[HISTBLOCK];
+  size_t npend;
+  struct hist *next;  /* all of them, for histreport() */
+};
+
+static struct hist *allhists;
+
+/* parseagg: the kind of bucket named, or NULL */
+static struct aggkind const *parseagg(char const *name)
+{
+  struct aggkind const *k;
+  for(k = aggkinds; k->name; k++)
+    if(!strcmp(name, k->name))
+      return k;
+  return NULL;
 }
 
-static unsigned qcin(char const *date, intdate *dt)
+static struct hist *newhist(void)
 {
-  struct caldate c;
-  uint64_t secs, t, f;
-  bool low;
-  unsigned n = readcal(&c, date, '*');
-  if(n != 1)
-    return n;
-  if(c.day > nrmdays[c.month - 1]) {
-    fprintf(stderr, "%s: day is out of range: %s\n", progname, date);
-    return 2;
+  struct hist *h = xrealloc(NULL, sizeof(*h));
+  h->mask = 255;
+  h->n = h->npend = 0;
+  h->b = calloc(h->mask + 1, sizeof(*h->b));
+  if(!h->b) {
+    fprintf(stderr, "%s: out of memory\n", progname);
+    exit(EXIT_FAILURE);
   }
-  low = (c.year < 323);
-  if(low)
-    c.year += 400UL - 323UL;
+  h->next = allhists;
+  allhists = h;
+  return h;
+}
+
+/* histslot: where the key is in the table, or would go */
+static struct bucket *histslot(struct hist const *h, uint64_t hi, uint64_t lo)
+{
+  uint64_t x = (hi ^ lo * UINT64_C(0x9e3779b97f4a7c15)) *
+      UINT64_C(0xff51afd7ed558ccd);
+  size_t i = (size_t)(x >> 32 ^ x) & h->mask;
+  while(h->b[i].count && (h->b[i].hi != hi || h->b[i].lo != lo))
+    i = (i + 1) & h->mask;
+  return &h->b[i];
+}
+
+/* histadd: count n dates in the bucket with the key; first is one */
+static void histadd(struct hist *h, uint64_t hi, uint64_t lo, uint64_t n,
+    intdate const *first)
+{
+  struct bucket *b = histslot(h, hi, lo);
+  if(b->count) {
+    b->count += n;
+    return;
+  }
+  b->hi = hi;
+  b->lo = lo;
+  b->count = n;
+  b->first = *first;
+  if(++h->n > h->mask / 2) {
+    /* Half full: double it */
+    struct bucket *old = h->b;
+    size_t i, size = h->mask + 1;
+    h->b = calloc(2 * size, sizeof(*h->b));
+    if(!h->b) {
+      fprintf(stderr, "%s: out of memory\n", progname);
+      exit(EXIT_FAILURE);
+    }
+    h->mask = 2 * size - 1;
+    for(i = 0; i < size; i++)
+      if(old[i].count)
+	*histslot(h, old[i].hi, old[i].lo) = old[i];
+    free(old);
+  }
+}
+
+/* histflush: count the dates waiting in h */
+static void histflush(struct hist *h)
+{
+  uint64_t year[HISTBLOCK];
+  int64_t issue[HISTBLOCK];
+  uint32_t units[HISTBLOCK], frac[HISTBLOCK];
+  uint8_t month[HISTBLOCK], day[HISTBLOCK], hour[HISTBLOCK],
+      min[HISTBLOCK], sec[HISTBLOCK];
+  struct sd_calcols cc;
+  struct sd_sdcols sc;
+  size_t i, n = h->npend;
+  h->npend = 0;
+  if(agg->fmt == 's') {
+    sc.issue = issue;
+    sc.units = units;
+    sc.frac = frac;
+    sd_sdoutv(h->pend, &sc, n);
+    /* With the sign bit flipped, the issues are in order unsigned */
+    for(i = 0; i < n; i++)
+      histadd(h, (uint64_t)issue[i] ^ UINT64_C(1) << 63,
+	  agg->by ? units[i] : 0, 1, &h->pend[i]);
+    return;
+  }
+  cc.year = year;
+  cc.month = month;
+  cc.day = day;
+  cc.hour = hour;
+  cc.min = min;
+  cc.sec = sec;
+  if(agg->fmt == 'g')
+    sd_gregoutv(h->pend, &cc, n);
+  else if(agg->fmt == 'j')
+    sd_juloutv(h->pend, &cc, n);
   else
-    c.year -= 323;
-  secs = qcepoch + c.year * (uint64_t)QCYEAR;
-  for(n = c.day - 1, c.month--; c.month--; )
-    n += nrmdays[c.month];
-  t = (uint64_t)(n * 86400UL + c.hour * 3600UL + c.min * 60UL + c.sec);
-  t *= QCYEAR;
-  f = ((uint64_t)(t % STDYEAR) << 32) + STDYEAR - 1;
-  secs += t / STDYEAR;
-  if(low)
-    secs -= quadcent;
-  dt->sec = secs;
-  dt->frac = (uint32_t)(f / STDYEAR);
-  return 1;
+    sd_qcoutv(h->pend, &cc, n);
+  for(i = 0; i < n; i++)
+    histadd(h, year[i], (agg->by > 1 ? month[i] * 32U : 0) +
+	(agg->by > 2 ? day[i] : 0), 1, &h->pend[i]);
 }
 
-static unsigned readcal(struct caldate *c, char const *date, char sep)
+/* tally: count the date on the line from line to end */
+static bool tally(char const *line, char const *end, struct sink *sk)
 {
-  int oerrno;
-  unsigned long ul;
-  char *ptr;
-  char const *pos = date;
-  if(!ISDIGIT(*pos))
-    return 0;
-  while(ISDIGIT(*++pos));
-  if(*pos++ != sep || !ISDIGIT(*pos))
-    return 0;
-  while(ISDIGIT(*++pos));
-  if(*pos++ != sep || !ISDIGIT(*pos))
-    return 0;
-  while(ISDIGIT(*++pos));
-  if(*pos) {
-    if((*pos != 'T' && *pos != 't') || !ISDIGIT(*++pos)) {
-      badtime:
-      fprintf(stderr, "%s: malformed time of day: %s\n", progname, date);
-      return 2;
-    }
-    while(ISDIGIT(*++pos));
-    if(*pos++ != ':' || !ISDIGIT(*pos))
-      goto badtime;
-    while(ISDIGIT(*++pos));
-    if(*pos) {
-      if(*pos++ != ':' || !ISDIGIT(*pos))
-	goto badtime;
-      while(ISDIGIT(*++pos));
-      if(*pos)
-	goto badtime;
-    }
-  }
-  errno = 0;
-  c->year = strtoull(date, &ptr, 10);
-  oerrno = errno;
-  errno = 0;
-  ul = strtoul(ptr+1, &ptr, 10);
-  if(errno || !ul || ul > 12UL) {
-    fprintf(stderr, "%s: month is out of range: %s\n", progname, date);
-    return 2;
-  }
-  c->month = ul;
-  ul = strtoul(ptr+1, &ptr, 10);
-  if(errno || !ul || ul > 31UL) {
-    fprintf(stderr, "%s: day is out of range: %s\n", progname, date);
-    return 2;
-  }
-  c->day = ul;
-  if(!*ptr) {
-    c->hour = c->min = c->sec = 0;
-    errno = oerrno;
+  struct hist *h = sk->hist;
+  unsigned n;
+  if(end > line && end[-1] == '\r')
+    end--;
+  if(line == end)
     return 1;
+  n = parse(line, (size_t)(end - line), &h->pend[h->npend], sk->stats);
+  if(n != SD_OK) {
+    reportn(sk, sd_strerror(n), line, (size_t)(end - line));
+    return 0;
   }
-  ul = strtoul(ptr+1, &ptr, 10);
-  if(errno || ul > 23UL) {
-    fprintf(stderr, "%s: hour is out of range: %s\n", progname, date);
-    return 2;
-  }
-  c->hour = ul;
-  ul = strtoul(ptr+1, &ptr, 10);
-  if(errno || ul > 59UL) {
-    fprintf(stderr, "%s: minute is out of range: %s\n", progname, date);
-    return 2;
-  }
-  c->min = ul;
-  if(!*ptr) {
-    c->sec = 0;
-    errno = oerrno;
-    return 1;
+  if(++h->npend == HISTBLOCK)
+    histflush(h);
+  return 1;
+}
+
+static int bucketcmp(void const *a, void const *b)
+{
+  struct bucket const *x = a, *y = b;
+  if(x->hi != y->hi)
+    return x->hi < y->hi ? -1 : 1;
+  return x->lo < y->lo ? -1 : x->lo > y->lo;
+}
+
+/* histreport: output the buckets of all the tables, added together */
+static void histreport(void)
+{
+  struct hist *tot = allhists, *h;
+  size_t i, n = 0;
+  for(h = allhists; h; h = h->next)
+    histflush(h);
+  for(h = tot->next; h; h = h->next)
+    for(i = 0; i <= h->mask; i++)
+      if(h->b[i].count)
+	histadd(tot, h->b[i].hi, h->b[i].lo, h->b[i].count, &h->b[i].first);
+  for(i = 0; i <= tot->mask; i++)
+    if(tot->b[i].count)
+      tot->b[n++] = tot->b[i];
+  qsort(tot->b, n, sizeof(*tot->b), bucketcmp);
+  for(i = 0; i < n; i++) {
+    char buf[SD_BUFSIZE], num[24], *p;
+    uint64_t c = tot->b[i].count;
+    size_t len;
+    if(agg->fmt == 's') {
+      len = sd_sdout(buf, &tot->b[i].first, 0);
+      if(!agg->by)
+	len = (size_t)(strchr(buf, ']') + 1 - buf);
+    } else {
+      if(agg->fmt == 'g')
+	sd_gregout(buf, &tot->b[i].first, 0);
+      else if(agg->fmt == 'j')
+	sd_julout(buf, &tot->b[i].first, 0);
+      else
+	sd_qcout(buf, &tot->b[i].first, 0);
+      /* Up to the T, less the day and the month as need be */
+      len = (size_t)(strchr(buf, 'T') - buf) - 3 * (3 - agg->by);
+    }
+    p = num + sizeof(num) - 1;
+    *p = '\n';
+    do
+      *--p = (char)('0' + c % 10);
+    while(c /= 10);
+    *--p = ' ';
+    sinkput(&stdsink, buf, len);
+    sinkput(&stdsink, p, (size_t)(num + sizeof(num) - p));
   }
-  ul = strtoul(ptr+1, &ptr, 10);
-  if(errno || ul > 59UL) {
-    fprintf(stderr, "%s: second is out of range: %s\n", progname, date);
-    return 2;
+}
+
+/* Streaming input.  Dates are read one per line, in large blocks, and   *
+ * converted in place in the input buffer.  Every input line produces    *
+ * exactly one output line, so that the output can be pasted alongside   *
+ * the input; blank lines, and lines that are not accepted, produce an   *
+ * empty output line.  A trailing CR is ignored, for DOS text files.     */
+
+#define INBUFSIZE 65536
+
+static char inbuf[INBUFSIZE];
+
+/* Column mode.  With -c, each line is a row of columns separated by *
+ * delim, and only the dates in the selected columns are converted;   *
+ * everything else is copied through byte for byte, without splitting *
+ * the line any further than the last selected column.  A column may  *
+ * be quoted, CSV style, and then its date is read from inside the    *
+ * quotes.  An empty column is left empty, and a date that can't be   *
+ * converted is reported and left as it was.                          */
+
+#define MAXCOLS 1024
+
+static uint64_t colbits[MAXCOLS / 64]; /* selected: column n is bit n-1 */
+static unsigned long colfrom;  /* and every column from this, if not 0 */
+static unsigned long lastcol;  /* the last selected in colbits */
+
+/* parsecols: read a list of columns, like cut(1): n, n-m, -m or n-, *
+ * separated by commas, counting from 1                              */
+static bool parsecols(char const *list)
+{
+  for(;;) {
+    unsigned long lo = 1, hi, c;
+    char *end;
+    if(*list >= '0' && *list <= '9') {
+      lo = strtoul(list, &end, 10);
+      list = end;
+    } else if(*list != '-')
+      return 0;
+    hi = lo;
+    if(*list == '-') {
+      hi = 0;
+      if(*++list >= '0' && *list <= '9') {
+	hi = strtoul(list, &end, 10);
+	list = end;
+      }
+    }
+    if(!lo || lo > MAXCOLS || (hi && (hi < lo || hi > MAXCOLS)))
+      return 0;
+    if(!hi) {
+      if(!colfrom || lo < colfrom)
+	colfrom = lo;
+    } else {
+      for(c = lo - 1; c < hi; c++)
+	colbits[c / 64] |= UINT64_C(1) << (c % 64);
+      if(hi > lastcol)
+	lastcol = hi;
+    }
+    if(!*list)
+      break;
+    if(*list++ != ',')
+      return 0;
   }
-  c->sec = ul;
-  errno = oerrno;
+  colmode = 1;
   return 1;
 }
 
-static unsigned unixin(char const *date, intdate *dt)
+static bool colsel(unsigned long col)
 {
-  char const *pos = date+1;
-  unsigned radix = 10;
-  bool neg;
-  char *ptr;
-  uint64_t mag;
-  if(date[0] != 'u' && date[0] != 'U')
-    return 0;
-  neg = (*pos == '-');
-  if(neg)
-    pos++;
-  if(pos[0] == '0' && (pos[1] == 'x' || pos[1] == 'X')) {
-    pos += 2;
-    radix = 16;
-  }
-  if(!ISALNUM(*pos)) {
-    bad:
-    fprintf(stderr, "%s: malformed Unix date: %s\n", progname, date);
-    return 2;
-  }
-  mag = strtoull(pos, &ptr, radix);
-  if(*ptr)
-    goto bad;
-  dt->sec = neg ? unixepoch - mag : unixepoch + mag;
-  dt->frac = 0;
-  return 1;
+  return (colfrom && col >= colfrom) ||
+      (col <= MAXCOLS && (colbits[(col - 1) / 64] >> ((col - 1) % 64) & 1));
 }
 
-static char const *tngsdout(intdate const *);
-
-static char const *sdout(intdate const *dt)
-{
-  bool isneg = 0;
-  uint32_t nissue = 0, integer = 0;
-  uint64_t frac;
-  static char ret[18];
-  if(tngepoch <= dt->sec)
-    return tngsdout(dt);
-  if(dt->sec < ufpepoch) {
-    /* Negative stardate */
-    uint64_t diff = ufpepoch - dt->sec - 1;
-    uint32_t nsecs = 2000UL*86400UL - 1 - (uint32_t)(diff % (2000UL * 86400UL));
-    isneg = 1;
-    nissue = 1 + (uint32_t)(diff / (2000UL * 86400UL));
-    integer = nsecs / (86400UL/5);
-    frac = ((uint64_t)(nsecs % (86400UL/5)) << 32 | dt->frac) * 50UL;
-  } else if(dt->sec < tngepoch) {
-    /* Positive stardate */
-    uint64_t diff = dt->sec - ufpepoch;
-    uint32_t nsecs = (uint32_t)(diff % (2000UL * 86400UL));
-    isneg = 0;
-    nissue = (uint32_t)(diff / (2000UL * 86400UL));
-    if(nissue < 19 || (nissue == 19 && nsecs < 7340UL * (86400UL/5))) {
-      /* TOS era */
-      integer = nsecs / (86400UL/5);
-      frac = ((uint64_t)(nsecs % (86400UL/5)) << 32 | dt->frac) * 50UL;
+/* convfields: convert the selected columns of the line from line to end */
+static bool convfields(char const *line, char const *end, struct sink *sk)
+{
+  char const *eol = end, *pos = line;
+  unsigned long col;
+  bool ok = 1;
+  if(eol > line && eol[-1] == '\r')
+    eol--;
+  for(col = 1; colfrom || col <= lastcol; col++) {
+    char const *field = pos, *stop, *next;
+    /* The date is from pos to stop, and the column ends at next. */
+    if(pos != eol && *pos == '"') {
+      for(stop = ++pos; (stop = memchr(stop, '"', (size_t)(eol - stop))); )
+	if(stop + 1 != eol && stop[1] == '"')
+	  stop += 2;
+	else
+	  break;
+      if(!stop)
+	stop = eol;
+      if(!(next = memchr(stop, delim, (size_t)(eol - stop))))
+	next = eol;
     } else {
-      /* Film era */
-      nsecs += (nissue - 19) * 2000UL*86400UL;
-      nissue = 19;
-      nsecs -= 7340UL * (86400UL/5);
-      if(nsecs >= 5000UL*86400UL) {
-	/* Late film era */
-	nsecs -= 5000UL*86400UL;
-	integer = 7840 + nsecs/(86400UL*2);
-	if(integer >= 10000) {
-	  integer -= 10000;
-	  nissue++;
-	}
-	frac = ((uint64_t)(nsecs % (86400UL*2)) << 32 | dt->frac) * 5UL;
+      if(!(next = memchr(pos, delim, (size_t)(eol - pos))))
+	next = eol;
+      stop = next;
+    }
+    if(pos != stop && colsel(col)) {
+      intdate dt;
+      unsigned n;
+      char *out;
+      out = NULL;
+      if(sk->cache && field - line <= OUTBUFSIZE - OUTLINEMAX) {
+	/* Into the space after the text so far, in case it's accepted */
+	out = sinkspace(sk, (size_t)(field - line) + OUTLINEMAX);
+	out = convat(out + (field - line), pos, stop, sk, &n);
+      } else
+	n = parse(pos, (size_t)(stop - pos), &dt, sk->stats);
+      if(n == SD_OK) {
+	sinkput(sk, line, (size_t)(field - line));
+	if(!out)
+	  out = putdate(sinkspace(sk, OUTLINEMAX), &dt, formats, sk->stats);
+	sk->outlen = (size_t)(out - sk->out);
+	line = next;
       } else {
-	/* Early film era */
-	integer = 7340 + nsecs/(86400UL*10);
-	frac = (uint64_t)(nsecs % (86400UL*10)) << 32 | dt->frac;
+	reportn(sk, sd_strerror(n), pos, (size_t)(stop - pos));
+	ok = 0;
       }
     }
+    if(next == eol)
+      break;
+    pos = next + 1;
   }
-  sprintf(ret, "[%s%lu]%04lu", isneg ? "-" : "", (unsigned long)nissue, (unsigned long)integer);
-  if(sddigits) {
-    char *ptr = strchr(ret, 0);
-    /* At this point, frac is a fractional part of a unit, in the range *
-     * 0 to (2^32 * 864000)-1.  In order to represent this as a 6-digit *
-     * decimal fraction, we need to scale this.  Mathematically, we     *
-     * need to multiply by 1000000 and divide by (2^32 * 864000).  But  *
-     * multiplying by 1000000 would cause overflow.  Cancelling the two *
-     * values yields an algorithm of multiplying by 125 and dividing by *
-     * (2^32*108).                                                      */
-    frac = frac * 125UL / 108UL;
-    sprintf(ptr, ".%06lu", (unsigned long)(uint32_t)(frac >> 32));
-    ptr[sddigits + 1] = 0;
-  }
-  return ret;
-}
-
-static char const *tngsdout(intdate const *dt)
-{
-  static char ret[36];
-  uint64_t h, l;
-  uint32_t nsecs;
-  uint64_t diff = dt->sec - tngepoch;
-  /* 1 issue is 86400*146097/4 seconds long, which just fits in 32 bits. */
-  uint64_t nissue = 21 + diff / ((86400UL/4)*146097UL);
-  nsecs = (uint32_t)(diff % ((86400UL/4)*146097UL));
-  /* 1 unit is (86400*146097/4)/100000 seconds, which isn't even. *
-   * It cancels to 27*146097/125.  For a six-figure fraction,     *
-   * divide that by 1000000.                                      */
-  h = (uint64_t)nsecs * 125000000UL;
-  l = (uint64_t)dt->frac * 125000000UL;
-  h += (uint32_t)(l >> 32);
-  h /= (27UL*146097UL);
-  sprintf(ret, "[%s]%05lu", uint64str(nissue, 10, 1),
-      (unsigned long)(uint32_t)(h / 1000000UL));
-  if(sddigits) {
-    char *ptr = strchr(ret, 0);
-    sprintf(ptr, ".%06lu", (unsigned long)(uint32_t)(h % 1000000UL));
-    ptr[sddigits + 1] = 0;
-  }
-  return ret;
-}
-
-/* New calc output: simple TNG-style stardate.
- * Converts intdate to Gregorian, then computes:
- *   stardate = (year - 2323) * 1000 + (day_of_year / days_in_year) * 1000
- */
-static char const *newcalcout(intdate const *dt)
-{
-  static char ret[24];
-  uint32_t tod = (uint32_t)(dt->sec % 86400UL);
-  uint64_t days = dt->sec / 86400UL;
-  uint64_t year;
-  unsigned ndays;
-  unsigned nmonth = 0;
-  unsigned cycle;
-  unsigned daysinyear;
-  double sd, frac;
-
-  /* Convert to Gregorian date -- same algorithm as calout(dt, 1) */
-  days += 146095UL;
-  year = (days / 146097UL) * 400UL + (days % 146097UL) / 366UL;
-  days = days + year / 100UL - year / 400UL;
-  days -= year * 365UL + year / 4UL;
-  year -= 399;
-  cycle = (unsigned)(year % 400UL);
-
-  /* Walk through months to get day-of-year */
-  ndays = (unsigned)days;
-  while(ndays >= xdays(1, cycle)[nmonth]) {
-    ndays -= xdays(1, cycle)[nmonth];
-    if(++nmonth == 12) {
-      nmonth = 0;
-      year++;
-      cycle = (unsigned)(year % 400UL);
-    }
-  }
-
-  /* Compute day-of-year (0-based) */
-  {
-    unsigned doy = 0;
-    unsigned m;
-    unsigned *mdays = gleapyear(year) ? lyrdays : nrmdays;
-    for(m = 0; m < nmonth; m++)
-      doy += mdays[m];
-    doy += ndays; /* ndays is 0-based day within month */
-    daysinyear = gleapyear(year) ? 366 : 365;
-
-    /* frac = (doy * 86400 + tod + dt->frac/2^32) / (daysinyear * 86400) */
-    frac = ((double)doy * 86400.0 + (double)tod +
-	(double)dt->frac / 4294967296.0) / ((double)daysinyear * 86400.0);
-  }
-
-  sd = ((double)year - 2323.0) * 1000.0 + frac * 1000.0;
-
-  /* Format the output */
-  if(newcalcdigits == 0) {
-    sprintf(ret, "%ld", (long)sd);
-  } else {
-    char fmt[16];
-    sprintf(fmt, "%%.%uf", newcalcdigits);
-    sprintf(ret, fmt, sd);
-  }
-  return ret;
+  sinkput(sk, line, (size_t)(end - line));
+  sinkput(sk, "\n", 1);
+  return ok;
 }
 
-static char const *calout(intdate const *, bool);
+static bool convline(char const *line, char const *end, struct sink *sk)
+{
+  if(sk->hist)
+    return tally(line, end, sk);
+  if(colmode)
+    return convfields(line, end, sk);
+  if(end > line && end[-1] == '\r')
+    end--;
+  if(line != end && convert(line, end, sk))
+    return 1;
+  output(NULL, sk);
+  return line == end;
+}
 
-static char const *julout(intdate const *dt)
+/* convlines: convert the lines from pos to end, the last of which need *
+ * not end in a newline.  Lines too long to have fitted in the input    *
+ * buffer are refused, just as convfile() would refuse them.            */
+static bool convlines(char const *pos, char const *end, char const *name,
+    struct sink *sk)
 {
-  return calout(dt, 0);
+  bool ok = 1;
+  while(pos != end) {
+    char const *nl = memchr(pos, '\n', (size_t)(end - pos));
+    char const *eol = nl ? nl : end;
+    if((size_t)(eol - pos) >= INBUFSIZE - 1) {
+      report(sk, name, "line too long");
+      output(NULL, sk);
+      ok = 0;
+    } else
+      ok &= convline(pos, eol, sk);
+    pos = nl ? nl + 1 : end;
+  }
+  return ok;
 }
 
-static char const *gregout(intdate const *dt)
+static bool convfile(FILE *fp, char const *name)
 {
-  return calout(dt, 1);
+  bool ok = 1, skip = 0;
+  size_t len = 0, n;
+  while((n = fread(inbuf + len, 1, INBUFSIZE - 1 - len, fp))) {
+    char *line = inbuf, *end = inbuf + len + n, *nl;
+    while((nl = memchr(line, '\n', (size_t)(end - line)))) {
+      if(skip)
+	skip = 0;
+      else
+	ok &= convline(line, nl, &stdsink);
+      line = nl + 1;
+    }
+    len = (size_t)(end - line);
+    if(len == INBUFSIZE - 1) {
+      /* No newline in a whole buffer: not a date we could accept. */
+      if(!skip) {
+	report(&stdsink, name, "line too long");
+	output(NULL, &stdsink);
+	ok = 0;
+	skip = 1;
+      }
+      len = 0;
+    } else
+      memmove(inbuf, line, len);
+  }
+  if(ferror(fp)) {
+    fprintf(stderr, "%s: %s: %s\n", progname, name, strerror(errno));
+    return 0;
+  }
+  if(len && !skip)
+    ok &= convline(inbuf, inbuf + len, &stdsink);
+  return ok;
 }
 
-static char const *docalout(char, bool, unsigned, uint64_t, unsigned, uint32_t);
+/* Memory-mapped input.  A regular file is mapped, and its lines are   *
+ * converted where they lie, with no copying into an input buffer; the *
+ * parallel mode hands out chunks of the mapping itself.  Anything that *
+ * can't be mapped, such as a pipe, is read as before.  The file offset *
+ * is moved to the end, as if the file had been read, so that naming   *
+ * the standard input twice doesn't convert it twice.                  */
 
-static char const *calout(intdate const *dt, bool gregp)
+static bool convinput(FILE *fp, char const *name)
 {
-  uint32_t tod = (uint32_t)(dt->sec % 86400UL);
-  uint64_t year, days = dt->sec / 86400UL;
-  /* We need the days number to be days since an xx01.01.01 to get the *
-   * leap year cycle right.  For the Julian calendar, it is already    *
-   * so (0001=01=01).  But for the Gregorian calendar, the epoch is    *
-   * 0000-12-30, so we must add on 400 years minus 2 days.  The year   *
-   * number gets corrected below.                                      */
-  if(gregp)
-    days += 146095UL;
-  /* Approximate the year number, underestimating but only by a limited *
-   * amount.  days/366 is a first approximation, but it goes out by 1   *
-   * day every non-leap year, and so will be a full year out after 366  *
-   * non-leap years.  In the Julian calendar, we get 366 non-leap years *
-   * every 488 years, so adding (days/366)/487 corrects for this.  In   *
-   * the Gregorian calendar, it is not so simple: we get 400 years      *
-   * every 146097 days, and then add on days/366 within that set of 400 *
-   * years.                                                             */
-  if(gregp)
-    year = (days / 146097UL) * 400UL + (days % 146097UL) / 366UL;
-  else
-    year = days / 366UL + days / (366UL * 487UL);
-  /* We then adjust the number of days remaining to match this *
-   * approximation of the year.  Note that this approximation  *
-   * will never be more than two years off the correct date,   *
-   * so the number of days left no longer needs to be stored   *
-   * in a uint64.                                              */
-  if(gregp)
-    days = days + year / 100UL - year / 400UL;
-  days -= year * 365UL + year / 4UL;
-  /* Now correct the year to an actual year number (see notes above). */
-  if(gregp)
-    year -= 399;
+  struct stat st;
+  int fd = fileno(fp);
+  off_t off;
+  void *map;
+  bool ok;
+  if(fstat(fd, &st) || !S_ISREG(st.st_mode) ||
+      (off = lseek(fd, 0, SEEK_CUR)) < 0 || off >= st.st_size ||
+      (uintmax_t)st.st_size > SIZE_MAX ||
+      (map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+	== MAP_FAILED)
+    return nthreads > 1 ? convfilepar(fp, name) : convfile(fp, name);
+  posix_madvise(map, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+  lseek(fd, st.st_size, SEEK_SET);
+  if(nthreads > 1)
+    ok = convmappar((char const *)map + off, (char const *)map + st.st_size,
+	name);
   else
-    year++;
-  return docalout(gregp ? '-' : '=', gregp, (unsigned)(year % 400UL),
-      year, (unsigned)days, tod);
-}
-
-static char const *docalout(char sep, bool gregp, unsigned cycle,
-    uint64_t year, unsigned ndays, uint32_t tod)
-{
-  unsigned nmonth = 0;
-  unsigned hr, min, sec;
-  static char ret[36];
-  /* Walk through the months, fixing the year, and as a side effect *
-   * calculating the month number and day of the month.             */
-  while(ndays >= xdays(gregp, cycle)[nmonth]) {
-    ndays -= xdays(gregp, cycle)[nmonth];
-    if(++nmonth == 12) {
-      nmonth = 0;
-      year++;
-      cycle++;
-    }
-  }
-  ndays++;
-  nmonth++;
-  /* Now sort out the time of day. */
-  hr = tod / 3600;
-  tod %= 3600;
-  min = tod / 60;
-  sec = tod % 60;
-  sprintf(ret, "%s%c%02d%c%02dT%02d:%02d:%02d",
-      uint64str(year, 10, 4), sep, nmonth, sep, ndays, hr, min, sec);
-  return ret;
-}
-
-static char const *qcout(intdate const *dt)
-{
-  uint64_t secs = dt->sec;
-  uint32_t nsec;
-  uint64_t year, h, l;
-  bool low;
-  low = (secs < qcepoch);
-  if(low)
-    secs += quadcent;
-  secs -= qcepoch;
-  nsec = (uint32_t)(secs % QCYEAR);
-  secs /= QCYEAR;
-  if(low)
-    year = secs - (400 - 323);
-  else
-    year = secs + 323;
-  /* We need to translate the nsec:dt->frac value (real seconds up to *
-   * 31556952:0) into quadcent seconds.  This can be done by          *
-   * multiplying by 146000 and dividing by 146097.  Normally this     *
-   * would overflow, so we do this in two parts.                      */
-  h = (uint64_t)nsec * 146000UL;
-  l = (uint64_t)dt->frac * 146000UL;
-  h += (uint32_t)(l >> 32);
-  nsec = (uint32_t)(h / 146097UL);
-  return docalout('*', 0, 1, year, nsec / 86400, nsec % 86400UL);
+    ok = convlines((char const *)map + off, (char const *)map + st.st_size,
+	name, &stdsink);
+  munmap(map, (size_t)st.st_size);
+  return ok;
 }
 
-static char const *unixout(intdate const *, unsigned, char const *);
+/* Binary records.  With -I, the input is packed records of dates rather *
+ * than lines of text, and with -O, so is the output, so that programs   *
+ * can exchange dates in bulk without formatting and parsing them.  The  *
+ * records are little-endian, with nothing between them:                 *
+ *   intdate  12 bytes: uint64 seconds from 0001=01=01, uint32 fraction  *
+ *   unix      8 bytes: int64 Unix time                                  *
+ *   sd       16 bytes: int64 issue, uint32 units, uint32 millionths     *
+ *   greg     16 bytes: uint64 year, uint8 month, day, hour, minute and  *
+ *   jul                second, and three zero bytes                     *
+ * Only the first two can be input.  Records are converted a block at a  *
+ * time by the library's batch conversions; text input that can't be    *
+ * converted is reported, and gives no record.                           */
+
+#define BINBLOCK 4096
+#define PACKCHUNK 256
+
+static struct {
+  char const *name;
+  size_t size;
+} const binkinds[] = {
+  { NULL,      0 },
+  { "intdate", 12 },
+  { "unix",    8 },
+  { "sd",      16 },
+  { "greg",    16 },
+  { "jul",     16 },
+};
+
+/* parsebin: the kind of record named, or BIN_NONE */
+static enum binkind parsebin(char const *name, enum binkind last)
+{
+  enum binkind k;
+  for(k = BIN_INTDATE; k <= last; k++)
+    if(!strcmp(name, binkinds[k].name))
+      return k;
+  return BIN_NONE;
+}
 
-static char const *unixdout(intdate const *dt)
+static void put32le(unsigned char *p, uint32_t v)
 {
-  return unixout(dt, 10, "");
+  p[0] = (unsigned char)v;
+  p[1] = (unsigned char)(v >> 8);
+  p[2] = (unsigned char)(v >> 16);
+  p[3] = (unsigned char)(v >> 24);
 }
 
-static char const *unixxout(intdate const *dt)
+static void put64le(unsigned char *p, uint64_t v)
 {
-  return unixout(dt, 16, "0x");
+  put32le(p, (uint32_t)v);
+  put32le(p + 4, (uint32_t)(v >> 32));
 }
 
-static char const *unixout(intdate const *dt, unsigned radix, char const *prefix)
+static uint32_t get32le(unsigned char const *p)
 {
-  static char ret[24];
-  char const *sgn;
-  uint64_t mag;
-  if(unixepoch <= dt->sec) {
-    sgn = "";
-    mag = dt->sec - unixepoch;
-  } else {
-    sgn = "-";
-    mag = unixepoch - dt->sec;
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+      (uint32_t)p[3] << 24;
+}
+
+static uint64_t get64le(unsigned char const *p)
+{
+  return get32le(p) | (uint64_t)get32le(p + 4) << 32;
+}
+
+/* packdates: write n dates as records of the -O kind at out */
+static void packdates(intdate const *dt, size_t n, unsigned char *out)
+{
+  int64_t i64[PACKCHUNK];
+  uint64_t year[PACKCHUNK];
+  uint32_t units[PACKCHUNK], frac[PACKCHUNK];
+  uint8_t month[PACKCHUNK], day[PACKCHUNK], hour[PACKCHUNK], min[PACKCHUNK],
+      sec[PACKCHUNK];
+  struct sd_sdcols sc;
+  struct sd_calcols cc;
+  size_t i, m;
+  sc.issue = i64;
+  sc.units = units;
+  sc.frac = frac;
+  cc.year = year;
+  cc.month = month;
+  cc.day = day;
+  cc.hour = hour;
+  cc.min = min;
+  cc.sec = sec;
+  for(; n; n -= m, dt += m) {
+    m = n < PACKCHUNK ? n : PACKCHUNK;
+    switch(binout) {
+      case BIN_INTDATE:
+	for(i = 0; i < m; i++, out += 12) {
+	  put64le(out, dt[i].sec);
+	  put32le(out + 8, dt[i].frac);
+	}
+	break;
+      case BIN_UNIX:
+	sd_unixoutv(dt, i64, m);
+	for(i = 0; i < m; i++, out += 8)
+	  put64le(out, (uint64_t)i64[i]);
+	break;
+      case BIN_SD:
+	sd_sdoutv(dt, &sc, m);
+	for(i = 0; i < m; i++, out += 16) {
+	  put64le(out, (uint64_t)i64[i]);
+	  put32le(out + 8, units[i]);
+	  put32le(out + 12, frac[i]);
+	}
+	break;
+      default:
+	if(binout == BIN_GREG)
+	  sd_gregoutv(dt, &cc, m);
+	else
+	  sd_juloutv(dt, &cc, m);
+	for(i = 0; i < m; i++, out += 16) {
+	  put64le(out, year[i]);
+	  out[8] = month[i];
+	  out[9] = day[i];
+	  out[10] = hour[i];
+	  out[11] = min[i];
+	  out[12] = sec[i];
+	  out[13] = out[14] = out[15] = 0;
+	}
+	break;
+    }
+  }
+}
+
+/* convbin: convert a file of records of the -I kind */
+static bool convbin(FILE *fp, char const *name)
+{
+  static unsigned char in[BINBLOCK * 12], out[BINBLOCK * 16];
+  static intdate dts[BINBLOCK];
+  static int64_t secs[BINBLOCK];
+  size_t size = binkinds[binin].size, len = 0, n, nrec, i;
+  while((n = fread(in + len, 1, BINBLOCK * size - len, fp))) {
+    len += n;
+    nrec = len / size;
+    if(binin == BIN_INTDATE)
+      for(i = 0; i < nrec; i++) {
+	dts[i].sec = get64le(in + 12 * i);
+	dts[i].frac = get32le(in + 12 * i + 8);
+      }
+    else {
+      for(i = 0; i < nrec; i++)
+	secs[i] = (int64_t)get64le(in + 8 * i);
+      sd_unixinv(secs, dts, nrec);
+    }
+    if(binout) {
+      packdates(dts, nrec, out);
+      sinkput(&stdsink, (char *)out, nrec * binkinds[binout].size);
+    } else
+      for(i = 0; i < nrec; i++)
+	output(&dts[i], &stdsink);
+    len -= nrec * size;
+    memmove(in, in + nrec * size, len);
   }
-  sprintf(ret, "U%s%s%s", sgn, prefix, uint64str(mag, radix, 1));
-  return ret;
+  if(ferror(fp)) {
+    fprintf(stderr, "%s: %s: %s\n", progname, name, strerror(errno));
+    return 0;
+  }
+  if(len) {
+    report(&stdsink, name, "incomplete record at end");
+    return 0;
+  }
+  return 1;
+}
+
+/* Parallel streaming input.  The main thread reads the input in      *
+ * chunks of whole lines, which a pool of worker threads convert, each  *
+ * into its own growing sink; the main thread then writes the chunks'   *
+ * output out in the order they were read.  Each line is converted just *
+ * as convfile() would, including the limit on its length, so the       *
+ * output is the same whatever the number of threads.                   */
+
+#define CHUNKSIZE (1024 * 1024)
+
+static struct job {
+  char const *in;  /* whole lines, the last perhaps without a newline */
+  size_t inlen;
+  char *buf;       /* CHUNKSIZE bytes, for input that isn't mapped */
+  char const *name;
+  bool toolong;    /* instead of lines, a line too long to convert */
+  bool done, ok;
+  struct sink sink;
+} *jobs;
+static unsigned njobs;
+static unsigned long nread, nclaimed, nwritten; /* jobs so far */
+static pthread_mutex_t joblock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t jobdone = PTHREAD_COND_INITIALIZER;
+
+static void *xrealloc(void *p, size_t size)
+{
+  if(!(p = realloc(p, size))) {
+    fprintf(stderr, "%s: out of memory\n", progname);
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static void runjob(struct job *j)
+{
+  if(j->toolong) {
+    report(&j->sink, j->name, "line too long");
+    output(NULL, &j->sink);
+    j->ok = 0;
+  } else
+    j->ok = convlines(j->in, j->in + j->inlen, j->name, &j->sink);
+}
+
+/* What each worker thread has of its own */
+struct workerown {
+  struct cache *cache;
+  struct stats *stats;
+  struct hist *hist;
+};
+
+static void *worker(void *arg)
+{
+  struct workerown const *own = arg;
+  for(;;) {
+    struct job *j;
+    pthread_mutex_lock(&joblock);
+    while(nclaimed == nread)
+      pthread_cond_wait(&jobready, &joblock);
+    j = &jobs[nclaimed++ % njobs];
+    pthread_mutex_unlock(&joblock);
+    j->sink.cache = own->cache;
+    j->sink.stats = own->stats;
+    j->sink.hist = own->hist;
+    runjob(j);
+    pthread_mutex_lock(&joblock);
+    j->done = 1;
+    pthread_cond_broadcast(&jobdone);
+    pthread_mutex_unlock(&joblock);
+  }
+  return NULL;
+}
+
+static void startpool(void)
+{
+  unsigned i;
+  pthread_t t;
+  njobs = 4 * nthreads;
+  jobs = xrealloc(NULL, njobs * sizeof(*jobs));
+  for(i = 0; i < njobs; i++) {
+    memset(&jobs[i], 0, sizeof(*jobs));
+    jobs[i].buf = xrealloc(NULL, CHUNKSIZE);
+    jobs[i].sink.grow = 1;
+  }
+  for(i = 0; i < nthreads; i++) {
+    struct workerown *own = xrealloc(NULL, sizeof(*own));
+    own->cache = ncache ? newcache(ncache) : NULL;
+    own->stats = statson ? newstats() : NULL;
+    own->hist = agg ? newhist() : NULL;
+    if((errno = pthread_create(&t, NULL, worker, own))) {
+      fprintf(stderr, "%s: can't start thread: %s\n", progname, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+/* writejob: wait for the oldest job still outstanding, and write it out */
+static bool writejob(void)
+{
+  struct job *j = &jobs[nwritten++ % njobs];
+  pthread_mutex_lock(&joblock);
+  while(!j->done)
+    pthread_cond_wait(&jobdone, &joblock);
+  pthread_mutex_unlock(&joblock);
+  if(j->sink.errlen)
+    fwrite(j->sink.err, 1, j->sink.errlen, stderr);
+  if(j->sink.outlen)
+    fwrite(j->sink.out, 1, j->sink.outlen, stdout);
+  j->sink.errlen = j->sink.outlen = 0;
+  statspoll();
+  return j->ok;
+}
+
+/* waitidle: wait until the worker threads, if any, have finished every *
+ * job submitted, so that they are left waiting for the next and are    *
+ * not touching their counters or caches                                */
+static void waitidle(void)
+{
+  unsigned long k;
+  if(!jobs)
+    return;
+  pthread_mutex_lock(&joblock);
+  for(k = nwritten; k != nread; k++)
+    while(!jobs[k % njobs].done)
+      pthread_cond_wait(&jobdone, &joblock);
+  pthread_mutex_unlock(&joblock);
+}
+
+/* newjob: the next free job, writing out the oldest if need be */
+static struct job *newjob(char const *name, bool *ok)
+{
+  struct job *j;
+  if(!jobs)
+    startpool();
+  if(nread - nwritten == njobs)
+    *ok &= writejob();
+  j = &jobs[nread % njobs];
+  j->name = name;
+  j->toolong = 0;
+  return j;
+}
+
+static void submit(void)
+{
+  pthread_mutex_lock(&joblock);
+  jobs[nread % njobs].done = 0;
+  nread++;
+  pthread_cond_signal(&jobready);
+  pthread_mutex_unlock(&joblock);
+}
+
+/* drain: write out every job still outstanding */
+static bool drain(void)
+{
+  bool ok = 1;
+  while(nwritten != nread)
+    ok &= writejob();
+  fflush(stdout);
+  return ok;
+}
+
+static bool convmappar(char const *pos, char const *end, char const *name)
+{
+  bool ok = 1;
+  outflush();
+  while(pos != end) {
+    struct job *j = newjob(name, &ok);
+    char const *nl = NULL;
+    if((size_t)(end - pos) > CHUNKSIZE)
+      nl = memchr(pos + CHUNKSIZE - 1, '\n', (size_t)(end - pos) - (CHUNKSIZE - 1));
+    j->in = pos;
+    pos = nl ? nl + 1 : end;
+    j->inlen = (size_t)(pos - j->in);
+    submit();
+  }
+  return drain() && ok;
+}
+
+static bool convfilepar(FILE *fp, char const *name)
+{
+  static char carry[CHUNKSIZE];
+  size_t ncarry = 0, n;
+  bool ok = 1, skip = 0, eof = 0;
+  outflush();
+  while(!eof) {
+    struct job *j = newjob(name, &ok);
+    char *buf = j->buf, *nl;
+    size_t len = ncarry;
+    memcpy(buf, carry, ncarry);
+    while(len < CHUNKSIZE && (n = fread(buf + len, 1, CHUNKSIZE - len, fp)))
+      len += n;
+    eof = len < CHUNKSIZE;
+    if(skip) {
+      /* the rest of a line already reported as too long */
+      if(!(nl = memchr(buf, '\n', len))) {
+	ncarry = 0;
+	continue;
+      }
+      skip = 0;
+      n = (size_t)(nl + 1 - buf);
+      memmove(buf, nl + 1, len - n);
+      len -= n;
+    }
+    for(nl = buf + len; nl != buf && nl[-1] != '\n'; nl--)
+      ;
+    if(nl == buf && len == CHUNKSIZE) {
+      /* No newline in a whole chunk: a line far too long. */
+      j->toolong = 1;
+      skip = 1;
+      nl = buf + len;
+    }
+    /* At the end of the input, the last line needn't end in a newline. */
+    if(eof)
+      nl = buf + len;
+    ncarry = (size_t)(buf + len - nl);
+    memcpy(carry, nl, ncarry);
+    j->in = buf;
+    j->inlen = j->toolong ? 0 : (size_t)(nl - buf);
+    if(j->inlen || j->toolong)
+      submit();
+  }
+  ok = drain() && ok;
+  if(ferror(fp)) {
+    fprintf(stderr, "%s: %s: %s\n", progname, name, strerror(errno));
+    return 0;
+  }
+  return ok;
+}
+
+/* Server mode.  With -S path, requests are read from connections to a  *
+ * Unix domain socket at path; with -S -, from the standard input, as a *
+ * coprocess.  Each request is a line of format options and a date,     *
+ * such as "-s -g 2024-01-15", and is answered with the line that the    *
+ * command line would output for it, or with "error: " and the reason if *
+ * it can't be converted.  A request with no format options uses those   *
+ * given on the command line.  Requests can be pipelined: each           *
+ * connection's answers are written back in order.  All the connections  *
+ * are served by one event loop, on epoll where there is one and poll    *
+ * elsewhere.                                                            */
+
+/* How much of its answers a connection may leave unread before we stop *
+ * reading its requests                                                 */
+#define CONNBACKLOG (1024 * 1024)
+
+#define MAXEVENTS 256
+
+struct conn {
+  int rfd, wfd;
+  char *in;
+  size_t inlen, insize;
+  bool skip;        /* discarding the rest of a line too long */
+  bool eof;         /* no more requests: close once the answers are out */
+  struct sink sink; /* the answers */
+  size_t outoff;    /* how much of them has been written */
+};
+
+struct event {
+  void *ptr;
+  bool in, out;
+};
+
+static volatile sig_atomic_t stopping;
+
+static void stop(int sig)
+{
+  (void)sig;
+  stopping = 1;
+}
+
+#ifdef __linux__
+
+static int evfd;
+
+static bool evinit(void)
+{
+  return (evfd = epoll_create1(0)) >= 0;
+}
+
+static void evset(int fd, void *ptr, bool in, bool out, bool add)
+{
+  struct epoll_event ev;
+  ev.events = (in ? EPOLLIN : 0) | (out ? EPOLLOUT : 0);
+  ev.data.ptr = ptr;
+  epoll_ctl(evfd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev);
+}
+
+static void evdel(int fd)
+{
+  struct epoll_event ev;
+  epoll_ctl(evfd, EPOLL_CTL_DEL, fd, &ev);
+}
+
+static int evwait(struct event *evs)
+{
+  struct epoll_event ees[MAXEVENTS];
+  int i, n = epoll_wait(evfd, ees, MAXEVENTS, -1);
+  for(i = 0; i < n; i++) {
+    evs[i].ptr = ees[i].data.ptr;
+    evs[i].in = ees[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR);
+    evs[i].out = ees[i].events & (EPOLLOUT | EPOLLERR);
+  }
+  return n;
+}
+
+#else
+
+static struct pollfd *pfds;
+static void **pptrs;
+static size_t npfds, pfdsize;
+
+static bool evinit(void)
+{
+  return 1;
+}
+
+static void evset(int fd, void *ptr, bool in, bool out, bool add)
+{
+  size_t i = 0;
+  if(add) {
+    if(npfds == pfdsize) {
+      pfdsize = pfdsize ? 2 * pfdsize : 64;
+      pfds = xrealloc(pfds, pfdsize * sizeof(*pfds));
+      pptrs = xrealloc(pptrs, pfdsize * sizeof(*pptrs));
+    }
+    i = npfds++;
+    pfds[i].fd = fd;
+    pptrs[i] = ptr;
+  } else
+    while(pfds[i].fd != fd)
+      i++;
+  pfds[i].events = (in ? POLLIN : 0) | (out ? POLLOUT : 0);
+}
+
+static void evdel(int fd)
+{
+  size_t i = 0;
+  while(pfds[i].fd != fd)
+    i++;
+  pfds[i] = pfds[--npfds];
+  pptrs[i] = pptrs[npfds];
+}
+
+static int evwait(struct event *evs)
+{
+  size_t i;
+  int n = 0;
+  if(poll(pfds, npfds, -1) < 0)
+    return -1;
+  for(i = 0; i < npfds && n < MAXEVENTS; i++)
+    if(pfds[i].revents) {
+      evs[n].ptr = pptrs[i];
+      evs[n].in = pfds[i].revents & (POLLIN | POLLHUP | POLLERR);
+      evs[n].out = pfds[i].revents & (POLLOUT | POLLERR);
+      n++;
+    }
+  return n;
+}
+
+#endif
+
+/* answer: an error answer, "error: what: why" */
+static void answererr(struct sink *sk, char const *what, char const *why,
+    size_t ly)
+{
+  size_t lw = strlen(what);
+  char *pos;
+  reserve(&sk->out, &sk->outsize, sk->outlen, lw + ly + 10);
+  pos = sk->out + sk->outlen;
+  memcpy(pos, "error: ", 7);
+  memcpy(pos + 7, what, lw);
+  pos += 7 + lw;
+  *pos++ = ':';
+  *pos++ = ' ';
+  memcpy(pos, why, ly);
+  pos += ly;
+  *pos++ = '\n';
+  sk->outlen = (size_t)(pos - sk->out);
+}
+
+/* request: answer one request, from line to end */
+static void request(char const *line, char const *end, struct sink *sk)
+{
+  struct format fmts[sizeof(formats) / sizeof(*formats)], *f;
+  bool sel = 0;
+  unsigned n;
+  intdate dt;
+  memcpy(fmts, formats, sizeof(fmts));
+  while(end > line && (end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t'))
+    end--;
+  while(line != end && (*line == ' ' || *line == '\t'))
+    line++;
+  while(end - line > 1 && *line == '-' && (line[1] < '0' || line[1] > '9')) {
+    if(!sel)
+      for(f = fmts; f->opt; f++)
+	f->sel = 0;
+    sel = 1;
+    while(++line != end && *line != ' ' && *line != '\t') {
+      for(f = fmts; f->opt && f->opt != *line; f++)
+	;
+      if(!f->opt) {
+	char opt[2] = { '-', 0 };
+	opt[1] = *line;
+	answererr(sk, "bad option", opt, 2);
+	return;
+      }
+      f->sel = 1;
+      if((*line == 's' || *line == 'n') && end - line > 1 &&
+	  line[1] >= '0' && line[1] <= '6')
+	f->digits = (unsigned)(*++line - '0');
+    }
+    while(line != end && (*line == ' ' || *line == '\t'))
+      line++;
+  }
+  if(line == end) {
+    outputf(NULL, fmts, sk);
+    return;
+  }
+  n = parse(line, (size_t)(end - line), &dt, sk->stats);
+  if(n == SD_OK)
+    outputf(&dt, fmts, sk);
+  else
+    answererr(sk, sd_strerror(n), line, (size_t)(end - line));
+}
+
+/* connread: read what requests there are on a connection, and answer *
+ * the complete ones.  Returns false on a read error.                 */
+static bool connread(struct conn *c)
+{
+  char *line, *end, *nl;
+  ssize_t n;
+  if(c->insize - c->inlen < 4096) {
+    c->insize = c->insize ? 2 * c->insize : 8192;
+    if(c->insize > INBUFSIZE)
+      c->insize = INBUFSIZE;
+    c->in = xrealloc(c->in, c->insize);
+  }
+  n = read(c->rfd, c->in + c->inlen, c->insize - c->inlen);
+  if(n < 0)
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+  if(!n)
+    c->eof = 1;
+  line = c->in;
+  end = c->in + c->inlen + n;
+  while((nl = memchr(line, '\n', (size_t)(end - line)))) {
+    if(c->skip)
+      c->skip = 0;
+    else
+      request(line, nl, &c->sink);
+    line = nl + 1;
+  }
+  c->inlen = (size_t)(end - line);
+  if(c->inlen == INBUFSIZE) {
+    if(!c->skip)
+      answererr(&c->sink, "request", "line too long", 13);
+    c->skip = 1;
+    c->inlen = 0;
+  } else
+    memmove(c->in, line, c->inlen);
+  if(c->eof && c->inlen && !c->skip)
+    request(c->in, c->in + c->inlen, &c->sink);
+  return 1;
+}
+
+/* connwrite: write what answers a connection can take.  Returns false *
+ * on a write error.                                                   */
+static bool connwrite(struct conn *c)
+{
+  while(c->outoff != c->sink.outlen) {
+    ssize_t n = write(c->wfd, c->sink.out + c->outoff,
+	c->sink.outlen - c->outoff);
+    if(n < 0) {
+      if(errno == EINTR)
+	continue;
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    c->outoff += (size_t)n;
+  }
+  c->outoff = c->sink.outlen = 0;
+  return 1;
+}
+
+static void connfree(struct conn *c)
+{
+  free(c->in);
+  free(c->sink.out);
+  free(c);
+}
+
+/* coproc: serve requests from the standard input */
+static bool coproc(void)
+{
+  struct conn c;
+  memset(&c, 0, sizeof(c));
+  c.wfd = 1;
+  c.sink.grow = 1;
+  c.sink.stats = stdsink.stats;
+  while(!c.eof && !stopping) {
+    statspoll();
+    if(!connread(&c) || !connwrite(&c)) {
+      fprintf(stderr, "%s: %s\n", progname, strerror(errno));
+      return 0;
+    }
+  }
+  free(c.in);
+  free(c.sink.out);
+  return 1;
+}
+
+/* connevent: handle the readiness of a connection; false if it's done */
+static bool connevent(struct conn *c, bool in)
+{
+  size_t pending;
+  if(in && !c->eof && !connread(c))
+    return 0;
+  if(!connwrite(c))
+    return 0;
+  pending = c->sink.outlen - c->outoff;
+  if(c->eof && !pending)
+    return 0;
+  evset(c->rfd, c, !c->eof && pending < CONNBACKLOG, pending != 0, 0);
+  return 1;
+}
+
+static bool serve(char const *path)
+{
+  struct sockaddr_un sa;
+  struct sigaction act;
+  struct event evs[MAXEVENTS];
+  struct stat st;
+  struct timespec backoff = { 0, 100000000L };
+  unsigned long nconns = 0;
+  bool listening = 1;
+  int lfd, lasterr = 0;
+  memset(&act, 0, sizeof(act));
+  act.sa_handler = stop;
+  sigemptyset(&act.sa_mask);
+  sigaction(SIGINT, &act, NULL);
+  sigaction(SIGTERM, &act, NULL);
+  act.sa_handler = SIG_IGN;
+  sigaction(SIGPIPE, &act, NULL);
+  if(!strcmp(path, "-"))
+    return coproc();
+  if(strlen(path) >= sizeof(sa.sun_path)) {
+    fprintf(stderr, "%s: %s: socket path too long\n", progname, path);
+    return 0;
+  }
+  memset(&sa, 0, sizeof(sa));
+  sa.sun_family = AF_UNIX;
+  strcpy(sa.sun_path, path);
+  /* a socket left behind by an earlier server is replaced */
+  if(!stat(path, &st) && S_ISSOCK(st.st_mode))
+    unlink(path);
+  if((lfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+      bind(lfd, (struct sockaddr *)&sa, sizeof(sa)) ||
+      listen(lfd, SOMAXCONN) ||
+      fcntl(lfd, F_SETFL, O_NONBLOCK) || !evinit()) {
+    fprintf(stderr, "%s: %s: %s\n", progname, path, strerror(errno));
+    return 0;
+  }
+  evset(lfd, NULL, 1, 0, 1);
+  while(!stopping) {
+    int i, n = evwait(evs);
+    statspoll();
+    for(i = 0; i < n; i++) {
+      struct conn *c = evs[i].ptr;
+      int fd;
+      if(c) {
+	if(!connevent(c, evs[i].in)) {
+	  evdel(c->rfd);
+	  close(c->rfd);
+	  connfree(c);
+	  nconns--;
+	  if(!listening) {
+	    evset(lfd, NULL, 1, 0, 0);
+	    listening = 1;
+	  }
+	}
+	continue;
+      }
+      while((fd = accept(lfd, NULL, NULL)) >= 0) {
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	c = xrealloc(NULL, sizeof(*c));
+	memset(c, 0, sizeof(*c));
+	c->rfd = c->wfd = fd;
+	c->sink.grow = 1;
+	c->sink.stats = stdsink.stats;
+	evset(fd, c, 1, 0, 1);
+	nconns++;
+	lasterr = 0;
+      }
+      if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ||
+	  errno == ECONNABORTED)
+	continue;
+      /* Out of descriptors, or the like.  The listener stays ready, so  *
+       * rather than spin on it, stop listening until a connection       *
+       * closes, or with none to wait for, back off a while.             */
+      if(errno != lasterr)
+	fprintf(stderr, "%s: %s: %s\n", progname, path, strerror(errno));
+      lasterr = errno;
+      if(nconns) {
+	evset(lfd, NULL, 0, 0, 0);
+	listening = 0;
+      } else
+	nanosleep(&backoff, NULL);
+    }
+  }
+  unlink(path);
+  return 1;
+}
+
+/* Range mode.  Every date from start to end, step apart, is output in *
+ * turn.  Rather than converting each date from scratch, the position  *
+ * is carried forward a step at a time, as whole seconds plus an exact *
+ * fraction num/den of a second past the start, so that no rounding    *
+ * error builds up however many steps are taken; and each format's    *
+ * conversion is carried on from the last date by its stepper.         */
+
+/* The units a step can be given in: seconds, minutes, hours, days, *
+ * and stardate units (of the post-[21] stardates, 1000 to a year   *
+ * of 365.2425 days: 3944619/125 seconds).                          */
+static struct stepunit {
+  char suffix;
+  uint64_t num, den;
+} const stepunits[] = {
+  { 's', 1, 1 },
+  { 'm', 60, 1 },
+  { 'h', 3600, 1 },
+  { 'd', 86400, 1 },
+  { 'u', 3944619, 125 },
+  { 0, 0, 0 }
+};
+
+/* parsestep: read a step, of up to six decimal places, as sec+num/den *
+ * seconds.  Returns false if it is malformed, out of range or zero.   */
+static bool parsestep(char const *arg, uint64_t *sec, uint64_t *num,
+    uint64_t *den)
+{
+  struct stepunit const *u = stepunits;
+  uint64_t whole = 0, frac = 0, scale = 1;
+  char const *p = arg;
+  if(*p < '0' || *p > '9')
+    return 0;
+  for(; *p >= '0' && *p <= '9'; p++) {
+    uint64_t d = (uint64_t)(*p - '0');
+    if(whole > (UINT64_MAX - d) / 10)
+      return 0;
+    whole = whole * 10 + d;
+  }
+  if(*p == '.')
+    for(p++; *p >= '0' && *p <= '9'; p++) {
+      if(scale == 1000000)
+	return 0;
+      frac = frac * 10 + (uint64_t)(*p - '0');
+      scale *= 10;
+    }
+  if(*p) {
+    while(u->suffix && u->suffix != *p)
+      u++;
+    if(!u->suffix || p[1])
+      return 0;
+  }
+  if(whole > UINT64_MAX / u->num)
+    return 0;
+  whole *= u->num;
+  *den = scale * u->den;
+  *sec = whole / u->den;
+  *num = whole % u->den * scale + frac * u->num;
+  if(*sec > UINT64_MAX - *num / *den)
+    return 0;
+  *sec += *num / *den;
+  *num %= *den;
+  return *sec || *num;
+}
+
+static bool range(char **argv)
+{
+  intdate ends[2], dt;
+  uint64_t step, snum, den, off = 0, num = 0;
+  unsigned i;
+  if(!argv[0] || !argv[1] || !argv[2] || argv[3]) {
+    fprintf(stderr, "%s: -r needs a start date, an end date and a step\n",
+	progname);
+    return 0;
+  }
+  for(i = 0; i < 2; i++) {
+    unsigned n = sd_anyin(argv[i], &ends[i]);
+    if(n != SD_OK) {
+      report(&stdsink, sd_strerror(n), argv[i]);
+      return 0;
+    }
+  }
+  if(!parsestep(argv[2], &step, &snum, &den)) {
+    fprintf(stderr, "%s: bad step: %s\n", progname, argv[2]);
+    return 0;
+  }
+  if(ends[1].sec < ends[0].sec ||
+      (ends[1].sec == ends[0].sec && ends[1].frac < ends[0].frac)) {
+    fprintf(stderr, "%s: range ends before it starts: %s %s\n", progname,
+	argv[0], argv[1]);
+    return 0;
+  }
+  for(i = 0; i < NFORMATS; i++)
+    sd_stepinit(&steppers[i], formats[i].opt, formats[i].digits);
+  carry = 1;
+  while(off <= ends[1].sec - ends[0].sec) {
+    uint64_t f = ends[0].frac + ((num << 32) + den - 1) / den;
+    uint64_t sec = ends[0].sec + off;
+    bool c;
+    dt.sec = sec + (f >> 32);
+    dt.frac = (uint32_t)f;
+    if(dt.sec < sec || dt.sec > ends[1].sec ||
+	(dt.sec == ends[1].sec && dt.frac > ends[1].frac))
+      break;
+    output(&dt, &stdsink);
+    if((c = (num += snum) >= den))
+      num -= den;
+    if(off > UINT64_MAX - step || off + step > UINT64_MAX - c)
+      break;
+    off += step + c;
+  }
+  return 1;
+}
+
+/* Range queries.  With -b, each file is taken to be a log sorted by   *
+ * the date at the start of each line, up to the first space, tab or   *
+ * delimiter, and the lines dated from start to end inclusive are      *
+ * copied out as they are.  A line whose date can't be read goes with  *
+ * the dated line before it, as the rest of a multi-line entry would.  *
+ * A regular file is mapped and bisected, so a query reads only the    *
+ * pages it lands on and the lines it outputs.  Anything that can't be *
+ * mapped, such as a pipe, is read through, stopping at the first line *
+ * after the end.                                                      *
+ *                                                                     *
+ * With -i N, the bisection starts from a sparse index of every Nth    *
+ * line's offset and date, kept beside the file as FILE.sdx.  It is   *
+ * built the first time, extended over whatever has been appended to   *
+ * the file since, and rebuilt if the file no longer matches it.  The  *
+ * index is little-endian: the magic "sdindex1", then the uint64       *
+ * spacing N, the number of bytes of the file indexed and the number   *
+ * of lines in them, followed by 20-byte entries of uint64 offset,    *
+ * uint64 seconds and uint32 fraction.                                 */
+
+#define IDXMAGIC "sdindex1"
+#define IDXHEAD 32
+#define IDXENTRY 20
+
+struct idxent {
+  uint64_t off;
+  intdate dt;
+};
+
+struct index {
+  struct idxent *ents;
+  size_t n, size;
+  uint64_t bytes, lines;  /* how much of the file it covers */
+};
+
+/* linedate: the date at the start of the line from pos to eol */
+static bool linedate(char const *pos, char const *eol, intdate *dt)
+{
+  char const *end = pos;
+  while(end != eol && *end != ' ' && *end != '\t' && *end != delim &&
+      *end != '\r')
+    end++;
+  return end != pos &&
+      parse(pos, (size_t)(end - pos), dt, stdsink.stats) == SD_OK;
+}
+
+/* before: whether dt comes before the first line wanted: one after *
+ * key, if past is set, or one at or after it                        */
+static bool before(intdate const *dt, intdate const *key, bool past)
+{
+  if(dt->sec != key->sec)
+    return dt->sec < key->sec;
+  return past ? dt->frac <= key->frac : dt->frac < key->frac;
+}
+
+/* bisect: the offset of the first line from lo to hi that doesn't come *
+ * before key (see before()), given that every line before lo does and *
+ * every line from hi on doesn't; lo is the start of a line.  The file  *
+ * is size bytes long.                                                  */
+static uint64_t bisect(char const *map, uint64_t size, uint64_t lo,
+    uint64_t hi, intdate const *key, bool past)
+{
+  while(lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2, s = mid, next;
+    char const *nl;
+    intdate dt;
+    /* The first line that can be read, starting at or after mid */
+    if(s != lo && map[s - 1] != '\n') {
+      nl = memchr(map + s, '\n', (size_t)(size - s));
+      s = nl ? (uint64_t)(nl - map) + 1 : size;
+    }
+    for(;; s = next) {
+      if(s >= hi) {
+	hi = mid;
+	break;
+      }
+      nl = memchr(map + s, '\n', (size_t)(size - s));
+      next = nl ? (uint64_t)(nl - map) + 1 : size;
+      if(linedate(map + s, nl ? nl : map + size, &dt)) {
+	if(before(&dt, key, past))
+	  lo = next;
+	else
+	  hi = mid;
+	break;
+      }
+    }
+  }
+  return lo;
+}
+
+/* nextdated: the offset of the first line from pos on with a date */
+static uint64_t nextdated(char const *map, uint64_t size, uint64_t pos)
+{
+  intdate dt;
+  while(pos < size) {
+    char const *nl = memchr(map + pos, '\n', (size_t)(size - pos));
+    if(linedate(map + pos, nl ? nl : map + size, &dt))
+      break;
+    pos = nl ? (uint64_t)(nl - map) + 1 : size;
+  }
+  return pos;
+}
+
+/* idxbound: narrow [*lo, *hi) to where bisect() need look for key */
+static void idxbound(struct index const *idx, uint64_t *lo, uint64_t *hi,
+    intdate const *key, bool past)
+{
+  size_t l = 0, h = idx->n;
+  while(l < h) {
+    size_t m = l + (h - l) / 2;
+    if(before(&idx->ents[m].dt, key, past))
+      l = m + 1;
+    else
+      h = m;
+  }
+  if(l)
+    *lo = idx->ents[l - 1].off;
+  if(l < idx->n)
+    *hi = idx->ents[l].off;
+}
+
+static void idxadd(struct index *idx, uint64_t off, intdate const *dt)
+{
+  if(idx->n == idx->size) {
+    idx->size = idx->size ? idx->size * 2 : 256;
+    idx->ents = xrealloc(idx->ents, idx->size * sizeof(*idx->ents));
+  }
+  idx->ents[idx->n].off = off;
+  idx->ents[idx->n++].dt = *dt;
+}
+
+/* idxload: read the index at path for a file mapped at map, of size *
+ * bytes; false if there is none, or it doesn't fit the file          */
+static bool idxload(struct index *idx, char const *path, char const *map,
+    uint64_t size)
+{
+  unsigned char head[IDXHEAD], ent[IDXENTRY];
+  FILE *fp = fopen(path, "rb");
+  bool ok = 0;
+  if(!fp)
+    return 0;
+  if(fread(head, 1, IDXHEAD, fp) == IDXHEAD &&
+      !memcmp(head, IDXMAGIC, 8) && get64le(head + 8) == spacing &&
+      (idx->bytes = get64le(head + 16)) <= size &&
+      (!idx->bytes || map[idx->bytes - 1] == '\n')) {
+    idx->lines = get64le(head + 24);
+    while(fread(ent, 1, IDXENTRY, fp) == IDXENTRY) {
+      intdate dt;
+      dt.sec = get64le(ent + 8);
+      dt.frac = get32le(ent + 16);
+      idxadd(idx, get64le(ent), &dt);
+    }
+    ok = !ferror(fp);
+  }
+  fclose(fp);
+  if(ok && idx->n) {
+    /* The last line indexed should still be there, with the same date */
+    struct idxent const *e = &idx->ents[idx->n - 1];
+    char const *nl;
+    intdate dt;
+    ok = e->off < idx->bytes &&
+	(nl = memchr(map + e->off, '\n', (size_t)(idx->bytes - e->off))) &&
+	linedate(map + e->off, nl, &dt) &&
+	dt.sec == e->dt.sec && dt.frac == e->dt.frac;
+  }
+  if(!ok)
+    idx->n = idx->bytes = idx->lines = 0;
+  return ok;
+}
+
+/* idxsave: write the index to path, through a temporary file */
+static bool idxsave(struct index const *idx, char const *path)
+{
+  unsigned char head[IDXHEAD], ent[IDXENTRY];
+  size_t len = strlen(path);
+  char *tmp = xrealloc(NULL, len + 5);
+  FILE *fp;
+  size_t i;
+  bool ok;
+  memcpy(tmp, path, len);
+  memcpy(tmp + len, ".new", 5);
+  if(!(fp = fopen(tmp, "wb"))) {
+    free(tmp);
+    return 0;
+  }
+  memcpy(head, IDXMAGIC, 8);
+  put64le(head + 8, spacing);
+  put64le(head + 16, idx->bytes);
+  put64le(head + 24, idx->lines);
+  fwrite(head, 1, IDXHEAD, fp);
+  for(i = 0; i < idx->n; i++) {
+    put64le(ent, idx->ents[i].off);
+    put64le(ent + 8, idx->ents[i].dt.sec);
+    put32le(ent + 16, idx->ents[i].dt.frac);
+    fwrite(ent, 1, IDXENTRY, fp);
+  }
+  ok = !ferror(fp);
+  ok &= !fclose(fp);
+  if(ok)
+    ok = !rename(tmp, path);
+  if(!ok)
+    remove(tmp);
+  free(tmp);
+  return ok;
+}
+
+/* idxextend: index the complete lines of the file after those already *
+ * indexed; true if there were any                                     */
+static bool idxextend(struct index *idx, char const *map, uint64_t size)
+{
+  uint64_t pos = idx->bytes;
+  bool want = 0;
+  char const *nl;
+  while(pos < size &&
+      (nl = memchr(map + pos, '\n', (size_t)(size - pos)))) {
+    intdate dt;
+    if(!(idx->lines++ % spacing))
+      want = 1;
+    if(want && linedate(map + pos, nl, &dt) &&
+	(!idx->n || !before(&dt, &idx->ents[idx->n - 1].dt, 0))) {
+      idxadd(idx, pos, &dt);
+      want = 0;
+    }
+    pos = (uint64_t)(nl - map) + 1;
+  }
+  if(pos == idx->bytes)
+    return 0;
+  idx->bytes = pos;
+  return 1;
+}
+
+/* querystream: the range query on a file that can't be mapped */
+static bool querystream(FILE *fp, char const *name, intdate const *ends)
+{
+  char *line = NULL;
+  size_t size = 0;
+  ssize_t len;
+  bool in = 0;
+  while((len = getline(&line, &size, fp)) > 0) {
+    intdate dt;
+    char const *eol = line + len - (line[len - 1] == '\n');
+    if(linedate(line, eol, &dt)) {
+      if(before(&dt, &ends[1], 1))
+	in = !before(&dt, &ends[0], 0);
+      else
+	break;
+    }
+    if(in) {
+      sinkput(&stdsink, line, (size_t)len);
+      if(eol == line + len)
+	sinkput(&stdsink, "\n", 1);
+    }
+  }
+  free(line);
+  if(ferror(fp)) {
+    fprintf(stderr, "%s: %s: %s\n", progname, name, strerror(errno));
+    return 0;
+  }
+  return 1;
+}
+
+/* queryfile: the range query on one file */
+static bool queryfile(FILE *fp, char const *name, intdate const *ends)
+{
+  struct index idx;
+  struct stat st;
+  uint64_t size, lo, hi, from, to;
+  char const *map;
+  void *m;
+  if(fstat(fileno(fp), &st) || !S_ISREG(st.st_mode) ||
+      (uintmax_t)st.st_size > SIZE_MAX)
+    return querystream(fp, name, ends);
+  if(!(size = (uint64_t)st.st_size))
+    return 1;
+  if((m = mmap(NULL, (size_t)size, PROT_READ, MAP_PRIVATE, fileno(fp), 0))
+      == MAP_FAILED)
+    return querystream(fp, name, ends);
+  map = m;
+  posix_madvise(m, (size_t)size, POSIX_MADV_RANDOM);
+  memset(&idx, 0, sizeof(idx));
+  lo = 0;
+  hi = size;
+  if(spacing && strcmp(name, "-")) {
+    size_t len = strlen(name);
+    char *path = xrealloc(NULL, len + 5);
+    memcpy(path, name, len);
+    memcpy(path + len, ".sdx", 5);
+    idxload(&idx, path, map, size);
+    if(idxextend(&idx, map, size) && !idxsave(&idx, path))
+      fprintf(stderr, "%s: %s: can't write index: %s\n", progname, path,
+	  strerror(errno));
+    free(path);
+    idxbound(&idx, &lo, &hi, &ends[0], 0);
+  }
+  from = nextdated(map, size, bisect(map, size, lo, hi, &ends[0], 0));
+  lo = from;
+  hi = size;
+  if(idx.n)
+    idxbound(&idx, &lo, &hi, &ends[1], 1);
+  if(lo < from)
+    lo = from;
+  if(hi < lo)
+    hi = lo;
+  to = nextdated(map, size, bisect(map, size, lo, hi, &ends[1], 1));
+  if(to > from) {
+    sinkput(&stdsink, map + from, (size_t)(to - from));
+    if(map[to - 1] != '\n')
+      sinkput(&stdsink, "\n", 1);
+  }
+  free(idx.ents);
+  munmap(m, (size_t)size);
+  return 1;
+}
+
+static bool query(char **argv)
+{
+  intdate ends[2];
+  bool ok = 1;
+  int i;
+  if(!argv[0] || !argv[1]) {
+    fprintf(stderr, "%s: -b needs a start date and an end date\n", progname);
+    return 0;
+  }
+  for(i = 0; i < 2; i++) {
+    unsigned n = sd_anyin(argv[i], &ends[i]);
+    if(n != SD_OK) {
+      report(&stdsink, sd_strerror(n), argv[i]);
+      return 0;
+    }
+  }
+  if(ends[1].sec < ends[0].sec ||
+      (ends[1].sec == ends[0].sec && ends[1].frac < ends[0].frac)) {
+    fprintf(stderr, "%s: range ends before it starts: %s %s\n", progname,
+	argv[0], argv[1]);
+    return 0;
+  }
+  argv += 2;
+  if(!*argv)
+    return queryfile(stdin, "-", ends);
+  for(; *argv; argv++) {
+    FILE *fp;
+    if(!strcmp(*argv, "-")) {
+      ok &= queryfile(stdin, "-", ends);
+      continue;
+    }
+    if(!(fp = fopen(*argv, "rb"))) {
+      fprintf(stderr, "%s: %s: %s\n", progname, *argv, strerror(errno));
+      ok = 0;
+      continue;
+    }
+    ok &= queryfile(fp, *argv, ends);
+    fclose(fp);
+  }
+  return ok;
+}
+
+/* Output is collected in a large buffer and written out in blocks, *
+ * rather than a character or a field at a time.                    */
+
+static char outbuf[OUTBUFSIZE];
+static struct sink stdsink = {
+  outbuf, NULL, 0, OUTBUFSIZE, 0, 0, 0, NULL, NULL, NULL
+};
+
+static void outflush(void)
+{
+  if(stdsink.outlen)
+    fwrite(outbuf, 1, stdsink.outlen, stdout);
+  stdsink.outlen = 0;
+  statspoll();
+}
+
+/* reserve: make room for need more bytes in a growing buffer */
+static void reserve(char **buf, size_t *size, size_t len, size_t need)
+{
+  size_t nsize = *size ? *size : 4096;
+  while(nsize - len < need)
+    nsize *= 2;
+  if(nsize != *size) {
+    *buf = xrealloc(*buf, nsize);
+    *size = nsize;
+  }
+}
+
+/* sinkspace: make room for need more bytes of output in sk, and *
+ * return where they go                                           */
+static char *sinkspace(struct sink *sk, size_t need)
+{
+  if(sk->outsize - sk->outlen < need) {
+    if(sk->grow)
+      reserve(&sk->out, &sk->outsize, sk->outlen, need);
+    else
+      outflush();
+  }
+  return sk->out + sk->outlen;
+}
+
+/* sinkput: output len bytes from p to sk */
+static void sinkput(struct sink *sk, char const *p, size_t len)
+{
+  if(!sk->grow && len > OUTBUFSIZE) {
+    outflush();
+    fwrite(p, 1, len, stdout);
+    return;
+  }
+  memcpy(sinkspace(sk, len), p, len);
+  sk->outlen += len;
+}
+
+/* report: an error message, "stardate: what: why" */
+static void report(struct sink *sk, char const *what, char const *why)
+{
+  reportn(sk, what, why, strlen(why));
+}
+
+/* reportn: the same, with why of length ly, not NUL-terminated */
+static void reportn(struct sink *sk, char const *what, char const *why, size_t ly)
+{
+  size_t lp = strlen(progname), lw = strlen(what);
+  char *pos;
+  reserve(&sk->err, &sk->errsize, sk->errlen, lp + lw + ly + 5);
+  pos = sk->err + sk->errlen;
+  memcpy(pos, progname, lp);
+  pos += lp;
+  *pos++ = ':';
+  *pos++ = ' ';
+  memcpy(pos, what, lw);
+  pos += lw;
+  *pos++ = ':';
+  *pos++ = ' ';
+  memcpy(pos, why, ly);
+  pos += ly;
+  *pos++ = '\n';
+  sk->errlen = (size_t)(pos - sk->err);
+  if(!sk->grow) {
+    fwrite(sk->err, 1, sk->errlen, stderr);
+    sk->errlen = 0;
+  }
+}
+
+/* output: write one line with the date in each selected format.  A null *
+ * date writes an empty line.  With -O, a record is written instead.    */
+static void output(intdate const *dt, struct sink *sk)
+{
+  if(sk->hist)
+    return;  /* -a outputs only the counts */
+  if(binout) {
+    /* A record, or nothing for no date */
+    if(dt) {
+      packdates(dt, 1, (unsigned char *)sinkspace(sk, 16));
+      sk->outlen += binkinds[binout].size;
+    }
+    return;
+  }
+  if(dt && sk->cache) {
+    char *pos = putcached(sinkspace(sk, OUTLINEMAX), dt, sk);
+    *pos++ = '\n';
+    sk->outlen = (size_t)(pos - sk->out);
+    return;
+  }
+  outputf(dt, formats, sk);
+}
+
+/* outputf: the same, with the formats selected in fmts */
+static void outputf(intdate const *dt, struct format const *fmts,
+    struct sink *sk)
+{
+  char *pos = sinkspace(sk, OUTLINEMAX);
+  if(dt)
+    pos = putdate(pos, dt, fmts, sk->stats);
+  *pos++ = '\n';
+  sk->outlen = (size_t)(pos - sk->out);
+}
+
+/* putdate: write the date at pos in each format selected in fmts,  *
+ * separated by spaces, and return the end; counted in st if it's    *
+ * not null.  Several formats are written together by sd_multiout(), *
+ * which shares the calendar arithmetic between them, but one at a   *
+ * time when they are to be timed, or in the range mode, where each  *
+ * is carried on from the last date by its stepper.                  */
+static char *putdate(char *pos, intdate const *dt, struct format const *fmts,
+    struct stats *st)
+{
+  struct format const *f;
+  char *start = pos;
+  char opts[NFORMATS + 1];
+  unsigned digits[NFORMATS], n = 0;
+  bool apart = carry;
+  for(f = fmts; f->opt; f++)
+    if(f->sel) {
+      opts[n] = f->opt;
+      digits[n++] = f->digits;
+      if(st && !(st->formatted[f - fmts]++ % STATSAMPLE))
+	apart = 1;
+    }
+  if(!apart && n > 1) {
+    opts[n] = 0;
+    return pos + sd_multiout(pos, dt, opts, digits);
+  }
+  for(f = fmts; f->opt; f++)
+    if(f->sel) {
+      unsigned i = (unsigned)(f - fmts);
+      bool timed = st && (st->formatted[i] - 1) % STATSAMPLE == 0;
+      uint64_t t = timed ? nsnow() : 0;
+      if(pos != start)
+	*pos++ = ' ';
+      if(carry)
+	pos += sd_stepout(pos, &steppers[i], dt);
+      else
+	pos += f->out(pos, dt, f->digits);
+      if(timed) {
+	st->formatns[i] += nstaken(t);
+	st->formattimed[i]++;
+      }
+    }
+  return pos;
 }
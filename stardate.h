@@ -0,0 +1,208 @@
+/*
+ *  stardate.h: interface to libstardate, the date conversion library
+ *  used by stardate(1)
+ *
+ *  Stardate code is based on version 1 of the Stardates in Star Trek FAQ.
+ */
+
+/*
+ * Copyright (c) 1996, 1997 Andrew Main.  All rights reserved.
+ *
+ * Redistribution and use, in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. All advertising materials mentioning features or use of this
+ *    software must display the following acknowledgement:
+ *        This product includes software developed by Andrew Main.
+ * 4. The name of Andrew Main may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL ANDREW MAIN BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef STARDATE_H
+#define STARDATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Internal date format: an extended Unix-style date format.
+ * This consists of the number of seconds since 0001=01=01 stored in a
+ * 64 bit type, plus an additional 32 bit fraction of a second.
+ * Each of the date formats used for I/O has a pair of functions,
+ * used for converting from/to the internal format.
+ *
+ * All the functions below are reentrant: they keep no state between
+ * calls but in the objects passed to them, and write only to those, so
+ * any number of threads may use them at once.
+ */
+
+typedef struct {
+  uint64_t sec; /* seconds since 0001=01=01; the input functions give
+		   SD_ERANGE for dates outside 0 to 2^64-1 */
+  uint32_t frac; /* range 0-(2^32-1) */
+} intdate;
+
+/* Input functions: each converts a date in one format to the internal
+ * format.  SD_NOMATCH means that the date is not in that format at all,
+ * so another format can be tried; SD_OK means that it was converted;
+ * anything else means that it is in the right format but can't be
+ * accepted, and sd_strerror() describes why.
+ */
+
+enum {
+  SD_NOMATCH = 0,
+  SD_OK,
+  SD_ERANGE,
+  SD_EINTEGER,
+  SD_EMONTH,
+  SD_EDAY,
+  SD_EHOUR,
+  SD_EMINUTE,
+  SD_ESECOND,
+  SD_ETIME,
+  SD_EUNIX
+};
+
+char const *sd_strerror(unsigned);
+
+unsigned sd_sdin(char const *, intdate *);
+unsigned sd_newcalcin(char const *, intdate *);
+unsigned sd_julin(char const *, intdate *);
+unsigned sd_gregin(char const *, intdate *);
+unsigned sd_qcin(char const *, intdate *);
+unsigned sd_unixin(char const *, intdate *);
+
+/* sd_classify looks at a date once and returns the option letter of the
+ * only input format it could be in ('s', 'n', 'j', 'g', 'q' or 'u'), or
+ * 0 if it can't be in any of them.  sd_anyin converts a date in any
+ * input format, using sd_classify to pick the parser.
+ *
+ * sd_classifyn and sd_anyinn do the same for a date given as a pointer
+ * and a length, which need not be NUL-terminated, such as a line in a
+ * file that has been read or mapped into memory.
+ */
+
+int sd_classify(char const *);
+unsigned sd_anyin(char const *, intdate *);
+int sd_classifyn(char const *, size_t);
+unsigned sd_anyinn(char const *, size_t, intdate *);
+
+/* Output functions: each writes a date in one format, NUL-terminated, to
+ * the buffer given, which must be at least SD_BUFSIZE bytes long, and
+ * returns its length.  The precision argument is the number of digits
+ * after the decimal point (0-6) for the stardate formats; the other
+ * formats ignore it.
+ */
+
+#define SD_BUFSIZE 40
+
+size_t sd_sdout(char *, intdate const *, unsigned);
+size_t sd_newcalcout(char *, intdate const *, unsigned);
+size_t sd_julout(char *, intdate const *, unsigned);
+size_t sd_gregout(char *, intdate const *, unsigned);
+size_t sd_qcout(char *, intdate const *, unsigned);
+size_t sd_unixdout(char *, intdate const *, unsigned);
+size_t sd_unixxout(char *, intdate const *, unsigned);
+
+/* sd_multiout writes a date in several formats at once, separated by
+ * spaces: the formats are given by their stardate(1) option letters in
+ * the string fmts ('s', 'n', 'j', 'g', 'q', 'u' and 'x'; any others are
+ * ignored), each with its precision in the array digits.  The buffer
+ * must be at least SD_BUFSIZE bytes long for each format.  The output
+ * is the same as from calling the single-format functions in turn, but
+ * the calendar dates share their day number and time of day, and the
+ * new calc stardate and quadcent date the Gregorian year; the stardate
+ * and Unix times are converted just as they are alone.
+ */
+
+size_t sd_multiout(char *, intdate const *, char const *, unsigned const *);
+
+/* Stepping through dates: a stepper writes a run of dates in one
+ * format, as its output function would, but carries its position from
+ * each date to the next, so that a date soon after the last costs only
+ * a few additions and the formatting.  sd_stepinit readies one for the
+ * format given by its option letter, as for sd_multiout, and precision;
+ * sd_stepout writes the next date, to a buffer of SD_BUFSIZE bytes, and
+ * returns its length.  A date earlier than the last is converted from
+ * scratch.  The fields of the stepper are private; one may be used by
+ * only one thread at a time.
+ */
+
+struct sd_stepper {
+  char fmt;
+  unsigned digits;
+  unsigned seg;
+  int neg;
+  uint64_t start, end, base;
+  uint32_t a, d;
+  uint64_t x, q, r;
+  uint64_t dx[2], dq[2], dr[2];
+  unsigned next;
+  uint64_t day;
+  size_t daylen;
+  char daybuf[SD_BUFSIZE];
+};
+
+void sd_stepinit(struct sd_stepper *, char, unsigned);
+size_t sd_stepout(char *, struct sd_stepper *, intdate const *);
+
+/* Batch conversions: each converts n dates at once, with the dates laid
+ * out struct-of-arrays, one array per field, so that many dates can be
+ * converted at a time with vector instructions.  The arrays must not
+ * overlap.
+ *
+ * sd_unixinv converts Unix times to the internal format, and sd_unixoutv
+ * back again, rounding down to a whole second.  Neither checks the
+ * range: Unix times before 0001=01=01 (-62135769600) wrap round to the
+ * far end of the internal range, where sd_unixin() would give SD_ERANGE,
+ * and dates more than 2^63 seconds after 1970 wrap round to negative
+ * Unix times.
+ *
+ * sd_greginv and sd_julinv convert calendar dates from their fields,
+ * store the status of each (as sd_gregin() would give it) in the status
+ * array if that is not null, and return the number converted; dates not
+ * converted are left untouched.  sd_gregoutv, sd_juloutv, sd_qcoutv and
+ * sd_sdoutv split dates into the fields of each format.  A stardate's
+ * issue is negative for the negative issues, and its fraction is in
+ * millionths of a unit.
+ */
+
+struct sd_calcols {
+  uint64_t *year;
+  uint8_t *month, *day, *hour, *min, *sec;
+};
+
+struct sd_sdcols {
+  int64_t *issue;
+  uint32_t *units;
+  uint32_t *frac;
+};
+
+void sd_unixinv(int64_t const *, intdate *, size_t);
+void sd_unixoutv(intdate const *, int64_t *, size_t);
+size_t sd_greginv(struct sd_calcols const *, intdate *, unsigned char *, size_t);
+size_t sd_julinv(struct sd_calcols const *, intdate *, unsigned char *, size_t);
+void sd_gregoutv(intdate const *, struct sd_calcols const *, size_t);
+void sd_juloutv(intdate const *, struct sd_calcols const *, size_t);
+void sd_qcoutv(intdate const *, struct sd_calcols const *, size_t);
+void sd_sdoutv(intdate const *, struct sd_sdcols const *, size_t);
+
+#endif /* STARDATE_H */
@@ -24,6 +24,27 @@ check() {
   fi
 }
 
+# Like check, but feeds $2 to the program on stdin
+check_stdin() {
+  local desc="$1"
+  shift
+  local expected="$1"
+  shift
+  local input="$1"
+  shift
+  local actual
+  actual=$(printf '%s' "$input" | "$STARDATE" "$@" 2>&1)
+  if [ "$actual" = "$expected" ]; then
+    PASS=$((PASS + 1))
+  else
+    FAIL=$((FAIL + 1))
+    echo "FAIL: $desc"
+    echo "  args:     $*"
+    echo "  expected: $expected"
+    echo "  actual:   $actual"
+  fi
+}
+
 # TNG stardate to Gregorian
 check "TNG stardate to Gregorian" \
   "2527-11-27T13:29:44" \
@@ -69,6 +90,12 @@ check "Negative stardate all formats" \
   "[-30]0458.96 1997=12=13T19:00:28 1997-12-26T19:00:28 1997*12*27T14:34:40 U883162828 U0x34a3fecc" \
   -s -j -g -q -u -x '[-30]0458.96'
 
+# Formats written together keep their own precisions
+check "Several formats with their own precisions" \
+  "[-30]4134.999 -323000.00003 1999=12=18T23:59:59 2000*01*01T07:51:16 U0x386d437f
+[-395]3530.000 -2322005.46448 0001=01=01T00:00:00 0000*12*31T02:03:16 U-0xe77949a00" \
+  -s3 -n5 -j -q -x 1999-12-31T23:59:59 0001=01=01
+
 # TOS era stardate
 check "TOS era [0]1000" \
   "[0]1000.00 2162=07=09T00:00:00 2162-07-23T00:00:00 2162*07*23T21:46:07 U6076512000 U0x16a303700" \
@@ -239,6 +266,392 @@ check "New calc: 46500.5 round-trip" \
   "46500.50" \
   -n 46500.5
 
+# New calc input: sub-second fractions survive the round-trip
+check "New calc: exact six-digit round-trip" \
+  "39708.612000" \
+  -n6 39708.612
+
+# Range errors are reported per field
+check "Month out of range" \
+  "stardate: month is out of range: 2024-13-01" \
+  -g 2024-13-01
+
+check "Hour out of range" \
+  "stardate: hour is out of range: 2024-01-01T25:00" \
+  -g 2024-01-01T25:00
+
+# Full-length dates are read by a faster path, which must report the
+# same errors, and leave anything not quite in the layout to the
+# general one
+check "Fixed layout: first field out of range is reported" \
+  "stardate: day is out of range: 2024-01-32T24:60:60
+stardate: second is out of range: 1999=12=31t23:59:60
+stardate: day is out of range: 0323*02*30" \
+  -g 2024-01-32T24:60:60 1999=12=31t23:59:60 '0323*02*30'
+
+check "Fixed layout: near misses" \
+  "stardate: malformed time of day: 2024-01-05T06:07:0x
+stardate: malformed time of day: 2024-01-05=06:07:08
+stardate: malformed time of day: 2024-01-05 06:07:08
+2024-01-05T06:07:08
+2024-01-05T06:07:00" \
+  -g 2024-1-5T06:07:08 2024-01-05T6:7 2024-01-05T06:07:0x \
+  2024-01-05=06:07:08 '2024-01-05 06:07:08'
+
+# A malformed time takes precedence over a field out of range
+check "Malformed time with bad month" \
+  "stardate: malformed time of day: 2024-13-01T1" \
+  -g 2024-13-01T1
+
+check "Stardate integer part out of range" \
+  "stardate: integer part is out of range: [20]5006" \
+  -g '[20]5006'
+
+check "Unix time too large" \
+  "stardate: date is out of acceptable range: U99999999999999999999" \
+  -g U99999999999999999999
+
+# Dates just outside the range, in each format, are out of range
+# rather than wrapping round to the other end of it
+check "Dates before the epoch and past the end" \
+  "stardate: date is out of acceptable range: 0000-12-29
+stardate: date is out of acceptable range: 0000=12=31T23:59:59
+stardate: date is out of acceptable range: 0000*12*31T02:03:15
+stardate: date is out of acceptable range: U-62135769601
+stardate: date is out of acceptable range: U18446744011573782016
+stardate: date is out of acceptable range: [-395]0000
+stardate: date is out of acceptable range: 584554049254-11-07T07:00:16
+0000-12-30T00:00:00 U-62135769600
+584554049254-11-07T07:00:15 U18446744011573782015" \
+  -g -u 0000-12-29 0000=12=31T23:59:59 '0000*12*31T02:03:15' U-62135769601 \
+  U18446744011573782016 '[-395]0000' 584554049254-11-07T07:00:16 \
+  0000-12-30 584554049254-11-07T07:00:15
+
+# New calc stardates read back over the whole range they are written in
+check "New calc stardates past the year 2^31" \
+  "2147485971-01-01T00:00:00
+584554049254-11-07T06:57:48" \
+  -g 2147483648000 584554046931850.11
+
+# Streaming: one output line per input line
+check_stdin "Stream mixed formats from stdin" \
+  "[-26]8035.00 2024-01-15T00:00:00
+[-36]9350.00 1970-01-01T00:00:00
+[23]04906.50 2527-11-27T13:29:44" \
+  "2024-01-15
+U0
+[23]4906.5" \
+  -s -g -f
+
+# Streaming: CRLF line endings and a missing final newline
+check_stdin "Stream CRLF input" \
+  "U1705276800
+U0" \
+  "$(printf '2024-01-15\r\nU0')" \
+  -u -f -
+
+# Streaming: bad and blank lines give empty output lines
+check_stdin "Stream keeps line alignment on errors" \
+  "stardate: date format unrecognised: bogus
+U0
+
+
+U1705276800" \
+  "U0
+bogus
+
+2024-01-15
+" \
+  -u -f
+
+# Streaming in parallel: several chunks' worth of lines, converted on
+# four threads, give the same output and messages as on one
+input=$(awk 'BEGIN { for(i = 0; i < 200000; i++) { print "U" i * 7919; if(i % 50000 == 0) print "bogus" } }')
+serial=$(echo "$input" | "$STARDATE" -s -g -f 2>&1 >/dev/null; echo "$input" | "$STARDATE" -s -g -f 2>/dev/null | cksum)
+parallel=$(echo "$input" | "$STARDATE" -s -g -P4 -f 2>&1 >/dev/null; echo "$input" | "$STARDATE" -s -g -P 4 -f 2>/dev/null | cksum)
+if [ "$serial" = "$parallel" ]; then
+  PASS=$((PASS + 1))
+else
+  FAIL=$((FAIL + 1))
+  echo "FAIL: Parallel stream matches serial"
+fi
+
+# The conversion cache: repeats, the same date written another way,
+# and more dates than a small cache holds, give the same output
+check_stdin "Cached conversions" \
+  "stardate: date format unrecognised: bogus
+stardate: cache: 4 hits, 9 misses, 0 evictions
+[-26]8035.00 2024-01-15T00:00:00
+[-26]8035.00 2024-01-15T00:00:00
+[-36]9350.00 1970-01-01T00:00:00
+[-26]8035.00 2024-01-15T00:00:00
+
+[-36]9350.00 1970-01-01T00:00:00
+[-36]9350.00 1970-01-01T00:00:01
+[-36]9350.00 1970-01-01T00:00:00" \
+  "2024-01-15
+2024-01-15
+U0
+U1705276800
+bogus
+U0
+U1
+1970-01-01
+" \
+  -s -g -C 1 -f
+
+input=$(awk 'BEGIN { for(i = 0; i < 50000; i++) print "U" (i * 7919) % 3000 }')
+plain=$(echo "$input" | "$STARDATE" -s -g -f | cksum)
+cached=$(echo "$input" | "$STARDATE" -s -g -C 100 -f 2>/dev/null | cksum)
+if [ "$plain" = "$cached" ]; then
+  PASS=$((PASS + 1))
+else
+  FAIL=$((FAIL + 1))
+  echo "FAIL: Cached stream matches uncached"
+fi
+
+# Statistics: the counts, without the timings, which vary
+actual=$(printf '2024-01-15\nU0\nbogus\n2024-13-01\n[-30]0\n' |
+  "$STARDATE" -m -s -g -f 2>&1 >/dev/null | tail -1 |
+  sed 's/"ns":[0-9.]*/"ns":T/g')
+expected='{"inputs":{"s":{"parsed":1,"failed":0,"ns":T},"n":{"parsed":0,"failed":0,"ns":T},"j":{"parsed":0,"failed":0,"ns":T},"g":{"parsed":1,"failed":1,"ns":T},"q":{"parsed":0,"failed":0,"ns":T},"u":{"parsed":1,"failed":0,"ns":T}},"errors":{"unrecognised":1,"range":0,"integer":0,"month":1,"day":0,"hour":0,"minute":0,"second":0,"time":0,"unix":0},"outputs":{"s":{"formatted":3,"ns":T},"n":{"formatted":0,"ns":T},"j":{"formatted":0,"ns":T},"g":{"formatted":3,"ns":T},"q":{"formatted":0,"ns":T},"u":{"formatted":0,"ns":T},"x":{"formatted":0,"ns":T}},"sample":64}'
+if [ "$actual" = "$expected" ]; then
+  PASS=$((PASS + 1))
+else
+  FAIL=$((FAIL + 1))
+  echo "FAIL: Statistics"
+  echo "  expected: $expected"
+  echo "  actual:   $actual"
+fi
+
+# Stardates either side of each change of rate
+check "Stardate era boundaries" \
+  "[19]7339.900000 2270-01-25T23:31:12
+[19]7340.000000 2270-01-26T00:00:00
+[19]7840.000000 2283-10-05T00:00:00
+[20]5005.500000 2322-12-31T00:00:00
+[21]00000.000000 2323-01-01T00:00:00
+[-1]9999.990000 2162-01-03T23:57:07" \
+  -s6 -g '[19]7339.9' '[19]7340' '[19]7840' '[20]5005.5' '[21]00000' '[-1]9999.99'
+
+# Ranges: across a month end in a leap year
+check "Range over a month end" \
+  "2024=02=16T12:00:00 2024-02-29T12:00:00
+2024=02=17T12:00:00 2024-03-01T12:00:00
+2024=02=18T12:00:00 2024-03-02T12:00:00" \
+  -j -g -r 2024-02-29T12:00:00 2024-03-02T12:00:00 1d
+
+# Ranges: stardate unit steps land exactly on the units
+check "Range in stardate units" \
+  "[41]00000.000000
+[41]00000.250000
+[41]00000.500000
+[41]00000.750000
+[41]00001.000000" \
+  -s6 -r '[41]00000' '[41]00001' 0.25u
+
+# Ranges: the same dates as converting them one by one
+input=$("$STARDATE" -u -r 2023-12-31T23:00:00 2024-01-02 7m)
+if [ "$("$STARDATE" -s -g -r 2023-12-31T23:00:00 2024-01-02 7m)" = \
+    "$(echo "$input" | "$STARDATE" -s -g -f)" ]; then
+  PASS=$((PASS + 1))
+else
+  FAIL=$((FAIL + 1))
+  echo "FAIL: Range matches per-date conversion"
+fi
+
+# Ranges: the positions carried from one date to the next are found
+# again at each new stardate era and issue, and each new year
+for start in 2161-12-31T12:00:00 2269-12-31T12:00:00 2283-09-01T12:00:00 \
+    2322-12-01T12:00:00 2399-12-31T12:00:00; do
+  input=$("$STARDATE" -u -r $start 2400-01-02 33187 | head -n 200)
+  end=$(echo "$input" | tail -n 1)
+  if [ -n "$input" ] &&
+      [ "$("$STARDATE" -s6 -n3 -j -g -q -x -r $start $end 33187)" = \
+      "$(echo "$input" | "$STARDATE" -s6 -n3 -j -g -q -x -f)" ]; then
+    PASS=$((PASS + 1))
+  else
+    FAIL=$((FAIL + 1))
+    echo "FAIL: Range from $start matches per-date conversion"
+  fi
+done
+
+check "Range with a bad step" \
+  "stardate: bad step: 1x" \
+  -r 2024-01-01 2024-01-02 1x
+
+check "Range that ends before it starts" \
+  "stardate: range ends before it starts: 2024-01-02 2024-01-01" \
+  -r 2024-01-02 2024-01-01 1d
+
+if "$STARDATE" -r 2024-01-02 2024-01-01 1d 2>/dev/null; then
+  FAIL=$((FAIL + 1))
+  echo "FAIL: Range that ends before it starts exits with failure"
+else
+  PASS=$((PASS + 1))
+fi
+
+# Columns: only the selected ones are converted, quoted or not, and
+# everything else is passed through
+check_stdin "Convert CSV columns" \
+  "stardate: date format unrecognised: when
+id,when,note
+1,2024-01-15T00:00:00,\"a, b\"
+2,1970-01-01T00:00:00,U0
+3,,x" \
+  'id,when,note
+1,U1705276800,"a, b"
+2,"U0",U0
+3,,x
+' \
+  -g -c 2
+
+check_stdin "Convert TSV column ranges" \
+  "$(printf 'a\t[-26]8035.00\t[-36]9350.00\tU1')" \
+  "$(printf 'a\t2024-01-15\tU0\tU1')" \
+  -s -d '\t' -c 2-3
+
+# Binary records: Unix times out and back in, and a stardate record
+actual=$("$STARDATE" -O unix U0 2024-01-15 | "$STARDATE" -I unix -g -u)
+if [ "$actual" = "1970-01-01T00:00:00 U0
+2024-01-15T00:00:00 U1705276800" ]; then
+  PASS=$((PASS + 1))
+else
+  FAIL=$((FAIL + 1))
+  echo "FAIL: Binary Unix records round trip"
+  echo "  actual:   $actual"
+fi
+
+actual=$("$STARDATE" -O sd '[-26]8035.5' | od -An -tx1 | tr -s ' \n' ' ')
+if [ "$actual" = " e6 ff ff ff ff ff ff ff 63 1f 00 00 20 a1 07 00 " ]; then
+  PASS=$((PASS + 1))
+else
+  FAIL=$((FAIL + 1))
+  echo "FAIL: Binary stardate record"
+  echo "  actual:   $actual"
+fi
+
+# Server, as a coprocess: per-request formats, and the default ones
+check_stdin "Coprocess requests" \
+  "[-26]8035.00
+41000.00 U12433392000
+
+error: month is out of range: 2024-13-01
+error: bad option: -z" \
+  "2024-01-15
+-n -u 2364-01-01
+
+2024-13-01
+-z 2024-01-15
+" \
+  -S -
+
+# Aggregation: counts by bucket, in order, whatever the threads
+check_stdin "Count by Gregorian day" \
+  "stardate: date format unrecognised: bad
+1970-01-01 1
+2024-01-15 2
+2024-01-16 1
+2024-02-01 1" \
+  "2024-01-15
+2024-01-15T12:00
+U0
+2024-02-01
+bad
+
+2024-01-16
+" \
+  -a gday
+
+check_stdin "Count by stardate unit" \
+  "[-36]9350 1
+[-26]8035 2" \
+  "U0
+2024-01-15T01:00
+[-26]8035.5
+" \
+  -a unit
+
+check_stdin "Count by Quadcent month on threads" \
+  "2024*01 2
+2024*02 1" \
+  "2024*01*31
+2024*02*01T00:00:01
+2024*01*01
+" \
+  -P 3 -a qmonth
+
+check "Aggregation with columns" \
+  "stardate: can't use -a with -I, -O, -c, -S or -C" \
+  -a gday -c 1
+
+# Range queries over a sorted log, in mixed formats, with undated lines
+# going with the line before: read through from a pipe, bisected from
+# a file, and from the index, fresh and after the log has grown
+log=$(mktemp)
+printf '%s\n' "1999-12-31 a" "U946684800 b" "# note" "2000-01-01T12:00:00,c" \
+  "[-30]4140 d" "  more d" "1999=12=21 e" "2000*01*04T07:48:25 f" > "$log"
+check_stdin "Query a piped log" \
+  "2000-01-01T12:00:00,c
+[-30]4140 d
+  more d" \
+  "$(cat "$log")" \
+  -b 2000-01-01T06:00 2000-01-02
+check "Query a log file" \
+  "U946684800 b
+# note
+2000-01-01T12:00:00,c
+[-30]4140 d
+  more d" \
+  -b 2000-01-01 U946771200 "$log"
+check "Query a log file through its index" \
+  "1999=12=21 e" \
+  -i 2 -b 2000-01-02T00:00:01 2000-01-03 "$log"
+printf '%s\n' "2000-01-05 g" "2000-01-06 h" >> "$log"
+check "Query a grown log through its index" \
+  "2000*01*04T07:48:25 f
+2000-01-05 g" \
+  -i 2 -b 2000-01-03T12:00 2000-01-05 "$log"
+check "Query past the end of a log" \
+  "" \
+  -b 2001-01-01 2002-01-01 "$log"
+check "Query that ends before it starts" \
+  "stardate: range ends before it starts: 2000-01-05 2000-01-03" \
+  -b 2000-01-05 2000-01-03 "$log"
+if "$STARDATE" -b 2000-01-05 2000-01-03 "$log" 2>/dev/null; then
+  FAIL=$((FAIL + 1))
+  echo "FAIL: Query that ends before it starts exits with failure"
+else
+  PASS=$((PASS + 1))
+fi
+rm -f "$log" "$log.sdx"
+
+# Watch mode: a line of the current time every period, which has
+# fractions of a second
+actual=$("$STARDATE" -s6 -u -w 20 | head -3 | sed 's/^\[-[0-9]*\][0-9]*\.[0-9]\{6\} U[0-9]*$/ok/')
+if [ "$actual" = "ok
+ok
+ok" ]; then
+  PASS=$((PASS + 1))
+else
+  FAIL=$((FAIL + 1))
+  echo "FAIL: Watch the current time"
+  echo "  actual:   $actual"
+fi
+
+actual=$("$STARDATE" -s6 -w 5 | head -20 | sort -u | wc -l)
+if [ "$actual" -gt 1 ]; then
+  PASS=$((PASS + 1))
+else
+  FAIL=$((FAIL + 1))
+  echo "FAIL: Current time has fractions of a second"
+  echo "  actual:   $actual distinct"
+fi
+
+check "Watch with a bad period" \
+  "stardate: bad period: 0" \
+  -w 0
+
 # -v prints version
 check "Version flag" \
   "stardate 1.7.0" \
@@ -0,0 +1,371 @@
+/*
+ *  verify_stardate: check the conversions in libstardate over a range
+ *
+ *  Every point in a range of times, or a random sample of them, is
+ *  written in each output format and read back in, and must come back
+ *  as the same text, and, but for new calc stardates (which are rounded
+ *  to the nearest), at or before the time written; and each output, and
+ *  the reading of it, must agree with a reference build of the library
+ *  from another revision (see refstardate.c).  All the formats written
+ *  together by sd_multiout() must be the same as each written alone,
+ *  and so must each written by a stepper (sd_stepout()) carried through
+ *  the points of a chunk in turn, one stepper per format, precision and
+ *  whether the points have fractions, so that their steps are regular.
+ *  The range is split into chunks, which the threads take in turn from
+ *  a shared counter as they finish the last (the work per point is
+ *  even, so there is no need for them to steal work from each other),
+ *  and the first point in the range that fails is reported.
+ *
+ *  Usage: verify_stardate [-P threads] [-f formats] [-n samples] [-R]
+ *             [start end [step]]
+ *  start and end are dates in any input format, and step is in seconds;
+ *  with -n, that many points are chosen at random from the range instead
+ *  of every step.  With no range, a million points are chosen from the
+ *  whole range of the internal format.  -f picks the formats to check,
+ *  by their stardate option letters (default snjgqux, all of them),
+ *  and -R skips the comparison with the reference.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stardate.h"
+
+/* The reference build, from refstardate.c */
+unsigned ref_sd_sdin(char const *, intdate *);
+unsigned ref_sd_newcalcin(char const *, intdate *);
+unsigned ref_sd_julin(char const *, intdate *);
+unsigned ref_sd_gregin(char const *, intdate *);
+unsigned ref_sd_qcin(char const *, intdate *);
+unsigned ref_sd_unixin(char const *, intdate *);
+size_t ref_sd_sdout(char *, intdate const *, unsigned);
+size_t ref_sd_newcalcout(char *, intdate const *, unsigned);
+size_t ref_sd_julout(char *, intdate const *, unsigned);
+size_t ref_sd_gregout(char *, intdate const *, unsigned);
+size_t ref_sd_qcout(char *, intdate const *, unsigned);
+size_t ref_sd_unixdout(char *, intdate const *, unsigned);
+size_t ref_sd_unixxout(char *, intdate const *, unsigned);
+
+static struct fmt {
+  char opt;
+  char const *name;
+  unsigned (*in)(char const *, intdate *);
+  size_t (*out)(char *, intdate const *, unsigned);
+  unsigned (*refin)(char const *, intdate *);
+  size_t (*refout)(char *, intdate const *, unsigned);
+  bool sel;
+} fmts[] = {
+  { 's', "sd",      sd_sdin,      sd_sdout,      ref_sd_sdin,      ref_sd_sdout,      1 },
+  { 'n', "newcalc", sd_newcalcin, sd_newcalcout, ref_sd_newcalcin, ref_sd_newcalcout, 1 },
+  { 'j', "jul",     sd_julin,     sd_julout,     ref_sd_julin,     ref_sd_julout,     1 },
+  { 'g', "greg",    sd_gregin,    sd_gregout,    ref_sd_gregin,    ref_sd_gregout,    1 },
+  { 'q', "qc",      sd_qcin,      sd_qcout,      ref_sd_qcin,      ref_sd_qcout,      1 },
+  { 'u', "unixd",   sd_unixin,    sd_unixdout,   ref_sd_unixin,    ref_sd_unixdout,   1 },
+  { 'x', "unixx",   sd_unixin,    sd_unixxout,   ref_sd_unixin,    ref_sd_unixxout,   1 },
+};
+#define NFMTS (sizeof(fmts) / sizeof(*fmts))
+
+/* The points to check: point i is start + i*step, or with sampling, a *
+ * time chosen from start to end by hashing i; every other point has a *
+ * fraction of a second too, and each is written to i%7 digits.        */
+static uint64_t start, end, step = 1, npoints;
+static bool sampling, noref;
+
+#define CHUNK 65536
+
+static uint64_t nchunks, nextchunk;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The first failure found so far, at point failed, or UINT64_MAX */
+static uint64_t failed = UINT64_MAX;
+static struct failure {
+  intdate dt;
+  unsigned digits;
+  char const *fmt, *what;
+  char text[NFMTS * SD_BUFSIZE], other[NFMTS * SD_BUFSIZE];
+} failure;
+
+/* mix: the splitmix64 finaliser, for choosing points and fractions */
+static uint64_t mix(uint64_t x)
+{
+  x += UINT64_C(0x9e3779b97f4a7c15);
+  x = (x ^ x >> 30) * UINT64_C(0xbf58476d1ce4e5b9);
+  x = (x ^ x >> 27) * UINT64_C(0x94d049bb133111eb);
+  return x ^ x >> 31;
+}
+
+static void point(uint64_t i, intdate *dt)
+{
+  uint64_t span = end - start, h;
+  if(sampling) {
+    h = mix(i);
+    dt->sec = start + (span == UINT64_MAX ? h : h % (span + 1));
+  } else
+    dt->sec = start + i * step;
+  dt->frac = i & 1 ? (uint32_t)(mix(dt->sec) >> 32) : 0;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* fail: describe how the check of f failed */
+static bool fail(struct failure *fl, struct fmt const *f, char const *what,
+    char const *text, char const *other)
+{
+  fl->fmt = f->name;
+  fl->what = what;
+  strcpy(fl->text, text);
+  strcpy(fl->other, other);
+  return 0;
+}
+
+static bool checkmulti(intdate const *, unsigned, struct failure *);
+static bool checkstep(intdate const *, unsigned, struct sd_stepper *,
+    struct failure *);
+
+/* check: check one point in every format selected, and its steppers *
+ * steps for those digits; on failure, say why                         */
+static bool check(intdate const *dt, unsigned digits, struct sd_stepper *steps,
+    struct failure *fl)
+{
+  char text[SD_BUFSIZE], again[SD_BUFSIZE];
+  unsigned f;
+  fl->dt = *dt;
+  fl->digits = digits;
+  for(f = 0; f < NFMTS; f++) {
+    struct fmt const *fm = &fmts[f];
+    intdate back, refback;
+    unsigned n;
+    if(!fm->sel)
+      continue;
+    fm->out(text, dt, digits);
+    if(!noref) {
+      fm->refout(again, dt, digits);
+      if(strcmp(text, again))
+	return fail(fl, fm, "written differently by the reference", text,
+	    again);
+    }
+    n = fm->in(text, &back);
+    if(!noref) {
+      unsigned rn = fm->refin(text, &refback);
+      if(rn != n || (n == SD_OK &&
+	  (back.sec != refback.sec || back.frac != refback.frac)))
+	return fail(fl, fm, "read differently by the reference", text,
+	    rn == n ? "(another time)" : sd_strerror(rn));
+    }
+    if(n != SD_OK) {
+      /* Negative new calc stardates are written, but can't be read */
+      if(fm->opt == 'n' && *text == '-')
+	continue;
+      return fail(fl, fm, "can't be read back", text, sd_strerror(n));
+    }
+    /* The others are rounded down; new calc stardates to the nearest */
+    if(fm->opt != 'n' &&
+	(back.sec > dt->sec || (back.sec == dt->sec && back.frac > dt->frac)))
+      return fail(fl, fm, "reads back later than it was", text, "");
+    fm->out(again, &back, digits);
+    if(strcmp(text, again))
+      return fail(fl, fm, "reads back as another date", text, again);
+  }
+  return checkmulti(dt, digits, fl) && checkstep(dt, digits, steps, fl);
+}
+
+/* checkmulti: sd_multiout() must write what the single formats do */
+static bool checkmulti(intdate const *dt, unsigned digits, struct failure *fl)
+{
+  static struct fmt const all = { 0, "all", 0, 0, 0, 0, 0 };
+  char each[NFMTS * SD_BUFSIZE], multi[NFMTS * SD_BUFSIZE], opts[NFMTS + 1];
+  unsigned dig[NFMTS], f, n = 0;
+  size_t len = 0;
+  *each = 0;
+  for(f = 0; f < NFMTS; f++)
+    if(fmts[f].sel) {
+      if(n)
+	each[len++] = ' ';
+      len += fmts[f].out(each + len, dt, digits);
+      opts[n] = fmts[f].opt;
+      dig[n++] = digits;
+    }
+  opts[n] = 0;
+  if(sd_multiout(multi, dt, opts, dig) != len || strcmp(each, multi))
+    return fail(fl, &all, "written differently together", multi, each);
+  return 1;
+}
+
+/* checkstep: each stepper must write what its format does */
+static bool checkstep(intdate const *dt, unsigned digits,
+    struct sd_stepper *steps, struct failure *fl)
+{
+  char text[SD_BUFSIZE], again[SD_BUFSIZE];
+  unsigned f;
+  for(f = 0; f < NFMTS; f++)
+    if(fmts[f].sel) {
+      size_t len = fmts[f].out(text, dt, digits);
+      if(sd_stepout(again, &steps[f], dt) != len || strcmp(text, again))
+	return fail(fl, &fmts[f], "written differently by a stepper", again,
+	    text);
+    }
+  return 1;
+}
+
+static void *worker(void *arg)
+{
+  struct failure fl;
+  struct sd_stepper steps[14][NFMTS];
+  unsigned d, f;
+  (void)arg;
+  for(;;) {
+    uint64_t c, i, last;
+    pthread_mutex_lock(&lock);
+    c = nextchunk++;
+    if(c >= nchunks || c * CHUNK > failed) {
+      pthread_mutex_unlock(&lock);
+      return NULL;
+    }
+    pthread_mutex_unlock(&lock);
+    last = npoints - c * CHUNK > CHUNK ? c * CHUNK + CHUNK : npoints;
+    for(d = 0; d < 14; d++)
+      for(f = 0; f < NFMTS; f++)
+	sd_stepinit(&steps[d][f], fmts[f].opt, d % 7);
+    for(i = c * CHUNK; i < last; i++) {
+      intdate dt;
+      point(i, &dt);
+      if(!check(&dt, (unsigned)(i % 7), steps[i % 14], &fl)) {
+	pthread_mutex_lock(&lock);
+	if(i < failed) {
+	  failed = i;
+	  failure = fl;
+	}
+	pthread_mutex_unlock(&lock);
+	break;
+      }
+    }
+  }
+}
+
+/* readdate: a date on the command line, in any input format */
+static uint64_t readdate(char const *arg)
+{
+  intdate dt;
+  unsigned n = sd_anyin(arg, &dt);
+  if(n != SD_OK) {
+    fprintf(stderr, "verify_stardate: %s: %s\n", sd_strerror(n), arg);
+    exit(EXIT_FAILURE);
+  }
+  return dt.sec;
+}
+
+/* readnum: a positive number on the command line */
+static uint64_t readnum(char const *arg, char const *what)
+{
+  char *e;
+  unsigned long long n;
+  errno = 0;
+  n = strtoull(arg, &e, 10);
+  if(*arg < '0' || *arg > '9' || *e || errno || !n) {
+    fprintf(stderr, "verify_stardate: bad %s: %s\n", what, arg);
+    exit(EXIT_FAILURE);
+  }
+  return n;
+}
+
+int main(int argc, char **argv)
+{
+  long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  pthread_t *threads;
+  char buf[SD_BUFSIZE];
+  double t;
+  long i;
+  int opt;
+  while((opt = getopt(argc, argv, "P:f:n:R")) != -1)
+    switch(opt) {
+      case 'P':
+	nthreads = (long)readnum(optarg, "number of threads");
+	break;
+      case 'f':
+	for(i = 0; i < (long)NFMTS; i++)
+	  fmts[i].sel = strchr(optarg, fmts[i].opt) != NULL;
+	break;
+      case 'n':
+	npoints = readnum(optarg, "number of samples");
+	sampling = 1;
+	break;
+      case 'R':
+	noref = 1;
+	break;
+      default:
+	return EXIT_FAILURE;
+    }
+  argv += optind;
+  argc -= optind;
+  if(argc == 0) {
+    end = UINT64_MAX;
+    if(!sampling) {
+      npoints = 1000000;
+      sampling = 1;
+    }
+  } else if(argc == 2 || argc == 3) {
+    start = readdate(argv[0]);
+    end = readdate(argv[1]);
+    if(argc == 3)
+      step = readnum(argv[2], "step");
+    if(end < start) {
+      fprintf(stderr, "verify_stardate: the range ends before it starts\n");
+      return EXIT_FAILURE;
+    }
+  } else {
+    fprintf(stderr, "Usage: verify_stardate [-P threads] [-f formats] "
+	"[-n samples] [-R] [start end [step]]\n");
+    return EXIT_FAILURE;
+  }
+  if(!sampling) {
+    if((end - start) / step == UINT64_MAX) {
+      fprintf(stderr, "verify_stardate: too many points; use -n\n");
+      return EXIT_FAILURE;
+    }
+    npoints = (end - start) / step + 1;
+  }
+  if(nthreads < 1)
+    nthreads = 1;
+  nchunks = npoints / CHUNK + (npoints % CHUNK != 0);
+  threads = malloc((size_t)nthreads * sizeof(*threads));
+  if(!threads) {
+    fprintf(stderr, "verify_stardate: out of memory\n");
+    return EXIT_FAILURE;
+  }
+  t = now();
+  for(i = 0; i < nthreads; i++)
+    if((errno = pthread_create(&threads[i], NULL, worker, NULL))) {
+      perror("verify_stardate: can't start thread");
+      return EXIT_FAILURE;
+    }
+  for(i = 0; i < nthreads; i++)
+    pthread_join(threads[i], NULL);
+  t = now() - t;
+  if(failed != UINT64_MAX) {
+    sd_gregout(buf, &failure.dt, 0);
+    printf("point %llu: %llu:%08lx (%s), %s to %u digits:\n"
+	"  \"%s\" %s%s%s%s\n",
+	(unsigned long long)failed, (unsigned long long)failure.dt.sec,
+	(unsigned long)failure.dt.frac, buf, failure.fmt, failure.digits,
+	failure.text, failure.what, *failure.other ? " (" : "",
+	failure.other, *failure.other ? ")" : "");
+    return EXIT_FAILURE;
+  }
+  printf("%llu points agree, in %.1f s (%.0f a second on %ld threads)\n",
+      (unsigned long long)npoints, t, npoints / t, nthreads);
+  return EXIT_SUCCESS;
+}